@@ -0,0 +1,728 @@
+#include "../include/custom_memory_resource.hpp"
+#include "../include/custom_stack.hpp"
+#include "../include/concurrent_custom_stack.hpp"
+#include "../include/concurrent_memory_resource.hpp"
+#include "../include/segmented_custom_stack.hpp"
+#include "../include/tlsf_memory_resource.hpp"
+#include "../include/expandable_memory_resource.hpp"
+#include "../include/recording_memory_resource.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <memory_resource>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <span>
+#include <stack>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Prints one CSV row per measurement:
+//   benchmark,subject,type,size,ns_per_op,allocations,peak_bytes,bytes_held,gap_before,gap_after
+// For container benchmarks allocations/peak_bytes are what the container requested from its
+// resource; for allocator benchmarks they are what the resource requested from its upstream,
+// i.e. its real memory footprint. bytes_held is what is still taken once the measured section
+// ends; gap_before/gap_after are the largest free gap before and after a compaction. These
+// columns are left empty where they mean nothing. Timings are the best of several repetitions.
+//   bench [TRACE]
+// keeps the allocation trace of the last RecordingMemoryResource run in TRACE, for replay; without
+// it the trace goes to a temporary file that is removed after every run.
+
+namespace {
+
+struct Int32 {
+    std::int32_t value;
+};
+
+struct Point3d {
+    double x;
+    double y;
+    double z;
+};
+
+struct Bytes64 {
+    std::int64_t value;
+    std::int64_t padding[7];
+};
+
+// The field make_item numbers and the iterate/drain benchmarks sum
+template<typename T>
+constexpr auto item_field = &T::value;
+
+template<>
+constexpr auto item_field<Point3d> = &Point3d::x;
+
+template<typename T>
+using item_field_type = std::remove_cvref_t<decltype(std::declval<T&>().*item_field<T>)>;
+
+template<typename T>
+T make_item(std::size_t index) {
+    T item{};
+    item.*item_field<T> = static_cast<item_field_type<T>>(index);
+    return item;
+}
+
+template<typename T>
+using PmrStack = CustomStack<T, std::pmr::polymorphic_allocator<T>>;
+
+// Keeps the optimiser from dropping the measured work
+template<typename T>
+void do_not_optimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Forwards to an upstream resource and records how much was requested through it; in-place
+// growth is passed through so that CustomStack behaves as it would without the counter
+class CountingResource: public ExpandableMemoryResource {
+
+private:
+
+    std::pmr::memory_resource* _upstream;
+    std::size_t _allocations{0};
+    std::size_t _bytes_in_use{0};
+    std::size_t _peak_bytes{0};
+
+public:
+
+    explicit CountingResource(std::pmr::memory_resource* upstream = std::pmr::new_delete_resource()) :
+        _upstream(upstream) {
+    }
+
+    std::size_t allocations() const {
+        return _allocations;
+    }
+
+    std::size_t peak_bytes() const {
+        return _peak_bytes;
+    }
+
+    std::size_t bytes_in_use() const {
+        return _bytes_in_use;
+    }
+
+private:
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        void* ptr = _upstream->allocate(bytes, alignment);
+        ++_allocations;
+        _bytes_in_use += bytes;
+        _peak_bytes = std::max(_peak_bytes, _bytes_in_use);
+        return ptr;
+    }
+
+    void do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment) override {
+        _upstream->deallocate(ptr, bytes, alignment);
+        _bytes_in_use -= bytes;
+    }
+
+    bool do_try_expand(void* ptr, std::size_t old_size, std::size_t new_size, std::size_t alignment) override {
+        auto* expandable = dynamic_cast<ExpandableMemoryResource*>(_upstream);
+        if (!expandable || !expandable->try_expand(ptr, old_size, new_size, alignment)) {
+            return false;
+        }
+        _bytes_in_use += new_size - old_size;
+        _peak_bytes = std::max(_peak_bytes, _bytes_in_use);
+        return true;
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+struct Measurement {
+    double nanoseconds{0};
+    std::size_t allocations{0};
+    std::size_t peak_bytes{0};
+    std::optional<std::size_t> bytes_held{};
+    std::optional<std::size_t> gap_before{};
+    std::optional<std::size_t> gap_after{};
+};
+
+std::string optional_column(const std::optional<std::size_t>& value) {
+    return value ? std::to_string(*value) : std::string();
+}
+
+// Runs the body several times and keeps the fastest run; the body times its own hot section
+void report(const std::string& benchmark, const std::string& subject, const std::string& type,
+            std::size_t size, std::size_t repetitions, const std::function<Measurement()>& body) {
+    Measurement best;
+    for (std::size_t repetition = 0; repetition < repetitions; ++repetition) {
+        Measurement measurement = body();
+        if (repetition == 0 || measurement.nanoseconds < best.nanoseconds) {
+            best = measurement;
+        }
+    }
+    std::printf("%s,%s,%s,%zu,%.3f,%zu,%zu,%s,%s,%s\n", benchmark.c_str(), subject.c_str(), type.c_str(), size,
+                best.nanoseconds / static_cast<double>(size), best.allocations, best.peak_bytes,
+                optional_column(best.bytes_held).c_str(), optional_column(best.gap_before).c_str(),
+                optional_column(best.gap_after).c_str());
+    std::fflush(stdout);
+}
+
+template<typename Body>
+double time_section(Body body) {
+    auto started = std::chrono::steady_clock::now();
+    body();
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count();
+}
+
+// Adapters giving CustomStack, std::stack and std::vector one interface for the workloads;
+// each routes its container's requests through its own counter
+template<typename T>
+struct CustomStackSubject {
+    static constexpr const char* name = "CustomStack";
+    static constexpr bool iterable = true;
+    CustomMemoryResource arena{AllocationMode::first_fit, std::pmr::new_delete_resource()};
+    CountingResource counting{&arena};
+    PmrStack<T> stack{1, &counting};
+
+    void push(const T& item) { stack.push(item); }
+    void pop() { stack.pop(); }
+    const T& top() const { return stack.top(); }
+    bool empty() const { return stack.empty(); }
+    const PmrStack<T>& range() const { return stack; }
+};
+
+template<typename T>
+struct SegmentedStackSubject {
+    static constexpr const char* name = "SegmentedCustomStack";
+    static constexpr bool iterable = false;
+    // Thousands of chunks would turn the first-fit arena's scan into the measured cost
+    CountingResource counting;
+    SegmentedCustomStack<T, std::pmr::polymorphic_allocator<T>> stack{&counting};
+
+    void push(const T& item) { stack.push(item); }
+    void pop() { stack.pop(); }
+    const T& top() const { return stack.top(); }
+    bool empty() const { return stack.empty(); }
+};
+
+template<typename T>
+struct StdStackSubject {
+    static constexpr const char* name = "std::stack";
+    static constexpr bool iterable = false;
+    CountingResource counting;
+    std::stack<T, std::pmr::vector<T>> stack{std::pmr::vector<T>(&counting)};
+
+    void push(const T& item) { stack.push(item); }
+    void pop() { stack.pop(); }
+    const T& top() const { return stack.top(); }
+    bool empty() const { return stack.empty(); }
+};
+
+template<typename T>
+struct StdVectorSubject {
+    static constexpr const char* name = "std::vector";
+    static constexpr bool iterable = true;
+    CountingResource counting;
+    std::pmr::vector<T> vector{&counting};
+
+    void push(const T& item) { vector.push_back(item); }
+    void pop() { vector.pop_back(); }
+    const T& top() const { return vector.back(); }
+    bool empty() const { return vector.empty(); }
+    const std::pmr::vector<T>& range() const { return vector; }
+};
+
+template<typename Subject, typename T>
+void bench_container(const std::string& type_name, std::size_t size, std::size_t repetitions) {
+    std::vector<T> items;
+    items.reserve(size);
+    for (std::size_t i = 0; i < size; ++i) {
+        items.push_back(make_item<T>(i));
+    }
+
+    report("push", Subject::name, type_name, size, repetitions, [&] {
+        Subject subject;
+        double elapsed = time_section([&] {
+            for (const T& item : items) {
+                subject.push(item);
+            }
+        });
+        do_not_optimize(subject.top());
+        return Measurement{elapsed, subject.counting.allocations(), subject.counting.peak_bytes()};
+    });
+
+    report("pop", Subject::name, type_name, size, repetitions, [&] {
+        Subject subject;
+        for (const T& item : items) {
+            subject.push(item);
+        }
+        double elapsed = time_section([&] {
+            while (!subject.empty()) {
+                subject.pop();
+            }
+        });
+        do_not_optimize(subject.empty());
+        return Measurement{elapsed, subject.counting.allocations(), subject.counting.peak_bytes()};
+    });
+
+    report("top", Subject::name, type_name, size, repetitions, [&] {
+        Subject subject;
+        subject.push(items.front());
+        double elapsed = time_section([&] {
+            for (std::size_t i = 0; i < size; ++i) {
+                do_not_optimize(subject.top().*item_field<T>);
+            }
+        });
+        return Measurement{elapsed, subject.counting.allocations(), subject.counting.peak_bytes()};
+    });
+
+    if constexpr (Subject::iterable) {
+        report("iterate", Subject::name, type_name, size, repetitions, [&] {
+            Subject subject;
+            for (const T& item : items) {
+                subject.push(item);
+            }
+            item_field_type<T> sum{0};
+            double elapsed = time_section([&] {
+                for (const T& item : subject.range()) {
+                    sum += item.*item_field<T>;
+                }
+            });
+            do_not_optimize(sum);
+            return Measurement{elapsed, subject.counting.allocations(), subject.counting.peak_bytes()};
+        });
+    }
+}
+
+// push_range/pop_n against loops of single calls on the same CustomStack setup
+template<typename T>
+void bench_bulk(const std::string& type_name, std::size_t size, std::size_t repetitions) {
+    std::vector<T> items;
+    items.reserve(size);
+    for (std::size_t i = 0; i < size; ++i) {
+        items.push_back(make_item<T>(i));
+    }
+
+    report("push_range", CustomStackSubject<T>::name, type_name, size, repetitions, [&] {
+        CustomStackSubject<T> subject;
+        double elapsed = time_section([&] {
+            subject.stack.push_range(std::span<const T>(items));
+        });
+        do_not_optimize(subject.top());
+        return Measurement{elapsed, subject.counting.allocations(), subject.counting.peak_bytes()};
+    });
+
+    report("pop_n", CustomStackSubject<T>::name, type_name, size, repetitions, [&] {
+        CustomStackSubject<T> subject;
+        subject.stack.push_range(std::span<const T>(items));
+        double elapsed = time_section([&] {
+            subject.stack.pop_n(subject.stack.size());
+        });
+        do_not_optimize(subject.empty());
+        return Measurement{elapsed, subject.counting.allocations(), subject.counting.peak_bytes()};
+    });
+}
+
+// Draining the stack with checked top/pop, try_pop and the unchecked calls
+template<typename T>
+void bench_fast_path(const std::string& type_name, std::size_t size, std::size_t repetitions) {
+    auto drain = [&](const std::string& benchmark, auto body) {
+        report(benchmark, CustomStackSubject<T>::name, type_name, size, repetitions, [&] {
+            CustomStackSubject<T> subject;
+            for (std::size_t i = 0; i < size; ++i) {
+                subject.push(make_item<T>(i));
+            }
+            item_field_type<T> sum{0};
+            double elapsed = time_section([&] {
+                body(subject.stack, sum);
+            });
+            do_not_optimize(sum);
+            return Measurement{elapsed, subject.counting.allocations(), subject.counting.peak_bytes()};
+        });
+    };
+
+    drain("drain_top_pop", [](PmrStack<T>& stack, auto& sum) {
+        while (!stack.empty()) {
+            sum += stack.top().*item_field<T>;
+            stack.pop();
+        }
+    });
+    drain("drain_try_pop", [](PmrStack<T>& stack, auto& sum) {
+        while (std::optional<T> item = stack.try_pop()) {
+            sum += (*item).*item_field<T>;
+        }
+    });
+    drain("drain_unchecked", [](PmrStack<T>& stack, auto& sum) {
+        while (!stack.empty()) {
+            sum += stack.unchecked_top().*item_field<T>;
+            stack.unchecked_pop();
+        }
+    });
+}
+
+// Growth policies on the same setup: "growth" pushes size elements, "burst" then pops all but
+// 1% of them and reports in bytes_held what the stack still holds afterwards
+template<typename Policy, typename T>
+void bench_growth(const std::string& policy_name, const std::string& type_name, std::size_t size,
+                  std::size_t repetitions) {
+    using Stack = CustomStack<T, std::pmr::polymorphic_allocator<T>, 0, Policy>;
+    std::string subject = "CustomStack/" + policy_name;
+
+    report("growth", subject, type_name, size, repetitions, [&] {
+        CountingResource counting;
+        Stack stack(1, &counting);
+        double elapsed = time_section([&] {
+            for (std::size_t i = 0; i < size; ++i) {
+                stack.push(make_item<T>(i));
+            }
+        });
+        do_not_optimize(stack.top());
+        return Measurement{elapsed, counting.allocations(), counting.peak_bytes()};
+    });
+
+    report("burst", subject, type_name, size, repetitions, [&] {
+        CountingResource counting;
+        Stack stack(1, &counting);
+        for (std::size_t i = 0; i < size; ++i) {
+            stack.push(make_item<T>(i));
+        }
+        double elapsed = time_section([&] {
+            while (stack.size() > size / 100) {
+                stack.pop();
+            }
+        });
+        do_not_optimize(stack.top());
+        return Measurement{elapsed, counting.allocations(), counting.peak_bytes(), counting.bytes_in_use()};
+    });
+}
+
+template<typename T>
+void bench_policies(const std::string& type_name, std::size_t size) {
+    std::size_t repetitions = size >= 1000000 ? 3 : 7;
+    bench_growth<GeometricGrowth<>, T>("x2", type_name, size, repetitions);
+    bench_growth<GeometricGrowth<3, 2>, T>("x1.5", type_name, size, repetitions);
+    bench_growth<CacheLineGrowth, T>("x2_cacheline", type_name, size, repetitions);
+    bench_growth<PageGrowth, T>("x2_page", type_name, size, repetitions);
+    bench_growth<FixedIncrementGrowth<4096>, T>("+4096", type_name, size, repetitions);
+    bench_growth<HysteresisShrink<>, T>("x2_shrink", type_name, size, repetitions);
+}
+
+template<typename T>
+void bench_containers(const std::string& type_name, std::size_t size) {
+    std::size_t repetitions = size >= 1000000 ? 3 : 7;
+    bench_container<CustomStackSubject<T>, T>(type_name, size, repetitions);
+    bench_bulk<T>(type_name, size, repetitions);
+    bench_fast_path<T>(type_name, size, repetitions);
+    bench_container<SegmentedStackSubject<T>, T>(type_name, size, repetitions);
+    bench_container<StdStackSubject<T>, T>(type_name, size, repetitions);
+    bench_container<StdVectorSubject<T>, T>(type_name, size, repetitions);
+}
+
+// The same pool arena behind a polymorphic_allocator, which goes through memory_resource's
+// virtual functions, and behind a CustomAllocator, which calls the arena directly
+template<typename Allocator>
+void bench_dispatch(const std::string& subject, std::size_t operations,
+                    const std::function<Allocator(CustomMemoryResource*)>& make) {
+    report("dispatch_alloc_free", subject, "int32", operations, 5, [&] {
+        CountingResource counting;
+        CustomMemoryResource arena(AllocationMode::pool, &counting);
+        Allocator allocator = make(&arena);
+        std::vector<Int32*> live(64, nullptr);
+        double elapsed = time_section([&] {
+            for (std::size_t i = 0; i < operations; ++i) {
+                Int32*& ptr = live[i % live.size()];
+                if (ptr) {
+                    allocator.deallocate(ptr, 1);
+                }
+                ptr = allocator.allocate(1);
+            }
+        });
+        for (Int32* ptr : live) {
+            if (ptr) {
+                allocator.deallocate(ptr, 1);
+            }
+        }
+        return Measurement{elapsed, counting.allocations(), counting.peak_bytes()};
+    });
+
+    report("dispatch_push", subject, "int32", operations, 5, [&] {
+        CountingResource counting;
+        CustomMemoryResource arena(AllocationMode::first_fit, &counting);
+        CustomStack<Int32, Allocator> stack(1, make(&arena));
+        double elapsed = time_section([&] {
+            for (std::size_t i = 0; i < operations; ++i) {
+                stack.push(make_item<Int32>(i));
+            }
+        });
+        do_not_optimize(stack.top());
+        return Measurement{elapsed, counting.allocations(), counting.peak_bytes()};
+    });
+}
+
+void bench_dispatches(std::size_t operations) {
+    bench_dispatch<std::pmr::polymorphic_allocator<Int32>>("polymorphic_allocator", operations,
+        [](CustomMemoryResource* arena) { return std::pmr::polymorphic_allocator<Int32>(arena); });
+    bench_dispatch<CustomAllocator<Int32>>("CustomAllocator", operations,
+        [](CustomMemoryResource* arena) { return CustomAllocator<Int32>(arena); });
+}
+
+// Sliding window of live blocks: every step frees the oldest block and allocates a new one
+void bench_churn(const std::string& subject, std::size_t min_block, std::size_t max_block, std::size_t operations,
+                 const std::function<std::unique_ptr<std::pmr::memory_resource>(std::pmr::memory_resource*)>& make) {
+    constexpr std::size_t WINDOW{256};
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<std::size_t> distribution(min_block, max_block);
+    std::vector<std::size_t> sizes(operations);
+    for (std::size_t& size : sizes) {
+        size = distribution(generator);
+    }
+
+    std::string benchmark = (min_block == max_block ? "churn_fixed" : "churn_max") + std::to_string(max_block);
+    report(benchmark, subject, "bytes", operations, 5, [&] {
+        CountingResource counting;
+        std::unique_ptr<std::pmr::memory_resource> memory_resource = make(&counting);
+        std::vector<std::pair<void*, std::size_t>> live(WINDOW, {nullptr, 0});
+        double elapsed = time_section([&] {
+            for (std::size_t i = 0; i < operations; ++i) {
+                auto& [ptr, bytes] = live[i % WINDOW];
+                if (ptr) {
+                    memory_resource->deallocate(ptr, bytes);
+                }
+                bytes = sizes[i];
+                ptr = memory_resource->allocate(bytes);
+            }
+        });
+        for (auto& [ptr, bytes] : live) {
+            if (ptr) {
+                memory_resource->deallocate(ptr, bytes);
+            }
+        }
+        return Measurement{elapsed, counting.allocations(), counting.peak_bytes()};
+    });
+}
+
+// Stacks of random sizes in one fixed 1 MiB arena, every other one freed: compact() time per
+// moved block, and the largest free gap before/after it. The arena takes nothing from an
+// upstream, so allocations/peak_bytes stay 0
+void bench_compaction(std::size_t stacks) {
+    report("compact", "CustomMemoryResource/first_fit", "int32", stacks / 2, 5, [&] {
+        std::mt19937 generator(42);
+        std::uniform_int_distribution<std::size_t> distribution(16, 512);
+        auto arena = std::make_unique<BasicCustomMemoryResource<std::size_t{1} << 20>>();
+        std::vector<std::optional<PmrStack<Int32>>> live(stacks);
+        for (std::optional<PmrStack<Int32>>& stack : live) {
+            std::size_t size = distribution(generator);
+            stack.emplace(size, arena.get());
+            stack->enable_relocation();
+            for (std::size_t i = 0; i < size; ++i) {
+                stack->push(make_item<Int32>(i));
+            }
+        }
+        for (std::size_t index = 0; index < stacks; index += 2) {
+            live[index].reset();
+        }
+        std::size_t gap_before = arena->statistics().largest_free_gap;
+        std::size_t moved{0};
+        double elapsed = time_section([&] {
+            moved = arena->compact();
+        });
+        do_not_optimize(moved);
+        Measurement measurement{elapsed * static_cast<double>(stacks / 2) / static_cast<double>(std::max<std::size_t>(moved, 1)),
+                                0, 0};
+        measurement.gap_before = gap_before;
+        measurement.gap_after = arena->statistics().largest_free_gap;
+        return measurement;
+    });
+}
+
+// Set from the command line to keep the trace of the last recorded run
+std::optional<std::filesystem::path> kept_trace_path;
+
+// Removes the trace once the recorder has closed it, unless it was asked for
+struct TraceFile {
+    std::filesystem::path path;
+
+    ~TraceFile() {
+        if (!kept_trace_path) {
+            std::error_code error;
+            std::filesystem::remove(path, error);
+        }
+    }
+};
+
+struct PoolHolder {
+    std::pmr::unsynchronized_pool_resource pool;
+};
+
+// An unsynchronized pool whose traffic is traced to a file, for the tracing overhead
+class RecordedPool: private TraceFile, private PoolHolder, public RecordingMemoryResource {
+
+public:
+
+    explicit RecordedPool(std::pmr::memory_resource* upstream) :
+        TraceFile{kept_trace_path.value_or(std::filesystem::temp_directory_path() / "bench.trace")},
+        PoolHolder{std::pmr::unsynchronized_pool_resource(upstream)},
+        RecordingMemoryResource(TraceFile::path.string(), &pool) {
+    }
+};
+
+void bench_allocators(std::size_t min_block, std::size_t max_block, std::size_t operations) {
+    bench_churn("CustomMemoryResource/first_fit", min_block, max_block, operations, [](std::pmr::memory_resource* upstream) {
+        return std::make_unique<CustomMemoryResource>(AllocationMode::first_fit, upstream);
+    });
+    bench_churn("CustomMemoryResource/pool", min_block, max_block, operations, [](std::pmr::memory_resource* upstream) {
+        return std::make_unique<CustomMemoryResource>(AllocationMode::pool, upstream);
+    });
+    bench_churn("CustomMemoryResource/bitmap", min_block, max_block, operations, [](std::pmr::memory_resource* upstream) {
+        return std::make_unique<CustomMemoryResource>(AllocationMode::bitmap, upstream, 16);
+    });
+    bench_churn("TlsfMemoryResource", min_block, max_block, operations, [](std::pmr::memory_resource* upstream) {
+        return std::make_unique<TlsfMemoryResource>(std::size_t{1} << 20, upstream);
+    });
+    bench_churn("RecordingMemoryResource/pool", min_block, max_block, operations, [](std::pmr::memory_resource* upstream) {
+        return std::make_unique<RecordedPool>(upstream);
+    });
+    bench_churn("monotonic_buffer_resource", min_block, max_block, operations, [](std::pmr::memory_resource* upstream) {
+        return std::make_unique<std::pmr::monotonic_buffer_resource>(upstream);
+    });
+    bench_churn("unsynchronized_pool_resource", min_block, max_block, operations, [](std::pmr::memory_resource* upstream) {
+        return std::make_unique<std::pmr::unsynchronized_pool_resource>(upstream);
+    });
+}
+
+// Every thread repeats push/pop pairs on one shared stack; ns_per_op is wall time per pair
+template<typename Stack>
+Measurement run_contention(Stack& stack, std::size_t threads, std::size_t pairs) {
+    std::vector<std::thread> workers;
+    double elapsed = time_section([&] {
+        for (std::size_t thread = 0; thread < threads; ++thread) {
+            workers.emplace_back([&stack, thread, pairs, threads] {
+                std::uint64_t sum{0};
+                for (std::size_t i = 0; i < pairs / threads; ++i) {
+                    stack.push(thread * pairs + i);
+                    if (auto item = stack.try_pop()) {
+                        sum += *item;
+                    }
+                }
+                do_not_optimize(sum);
+            });
+        }
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    });
+    return Measurement{elapsed, 0, 0};
+}
+
+struct LockedStack {
+    PmrStack<std::uint64_t> stack;
+    std::mutex mutex;
+
+    explicit LockedStack(std::pmr::memory_resource* memory_resource) :
+        stack(1, memory_resource) {
+    }
+
+    void push(std::uint64_t item) {
+        std::lock_guard<std::mutex> lock(mutex);
+        stack.push(item);
+    }
+
+    std::optional<std::uint64_t> try_pop() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stack.empty()) {
+            return std::nullopt;
+        }
+        std::uint64_t item = stack.top();
+        stack.pop();
+        return item;
+    }
+};
+
+// Every thread frees and allocates small blocks in a window of its own on one shared resource;
+// ns_per_op is wall time per free/allocate pair
+Measurement run_allocation_contention(std::pmr::memory_resource& memory_resource, std::size_t threads, std::size_t pairs) {
+    constexpr std::size_t WINDOW{16};
+    std::vector<std::thread> workers;
+    double elapsed = time_section([&] {
+        for (std::size_t thread = 0; thread < threads; ++thread) {
+            workers.emplace_back([&memory_resource, pairs, threads] {
+                std::array<void*, WINDOW> live{};
+                for (std::size_t i = 0; i < pairs / threads; ++i) {
+                    std::size_t slot = i % WINDOW;
+                    std::size_t bytes = 8 * (1 + slot % 8);
+                    if (live[slot]) {
+                        memory_resource.deallocate(live[slot], bytes);
+                    }
+                    live[slot] = memory_resource.allocate(bytes);
+                }
+                for (std::size_t slot = 0; slot < WINDOW; ++slot) {
+                    if (live[slot]) {
+                        memory_resource.deallocate(live[slot], 8 * (1 + slot % 8));
+                    }
+                }
+            });
+        }
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    });
+    return Measurement{elapsed, 0, 0};
+}
+
+void bench_contention(std::size_t threads, std::size_t pairs) {
+    std::string benchmark = "contention_t" + std::to_string(threads);
+    report(benchmark, "ConcurrentCustomStack", "uint64", pairs, 5, [&] {
+        CustomMemoryResource arena{AllocationMode::first_fit, std::pmr::new_delete_resource()};
+        ConcurrentCustomStack<std::uint64_t, std::pmr::polymorphic_allocator<std::uint64_t>> stack(&arena);
+        return run_contention(stack, threads, pairs);
+    });
+    report(benchmark, "mutex+CustomStack", "uint64", pairs, 5, [&] {
+        CustomMemoryResource arena{AllocationMode::first_fit, std::pmr::new_delete_resource()};
+        LockedStack stack(&arena);
+        return run_contention(stack, threads, pairs);
+    });
+    report(benchmark, "CustomMemoryResource/pool", "bytes", pairs, 5, [&] {
+        CustomMemoryResource memory_resource{AllocationMode::pool, std::pmr::new_delete_resource()};
+        return run_allocation_contention(memory_resource, threads, pairs);
+    });
+    report(benchmark, "ConcurrentCustomMemoryResource", "bytes", pairs, 5, [&] {
+        ConcurrentCustomMemoryResource<> memory_resource{AllocationMode::pool, std::pmr::new_delete_resource()};
+        return run_allocation_contention(memory_resource, threads, pairs);
+    });
+}
+
+}
+
+int main(int argc, char** argv) {
+    if (argc > 2) {
+        std::fprintf(stderr, "Usage: %s [TRACE]\n", argv[0]);
+        return 2;
+    }
+    if (argc == 2) {
+        kept_trace_path = argv[1];
+    }
+    std::printf("benchmark,subject,type,size,ns_per_op,allocations,peak_bytes,bytes_held,gap_before,gap_after\n");
+    for (std::size_t size : {std::size_t{1000}, std::size_t{100000}, std::size_t{1000000}}) {
+        bench_containers<Int32>("int32", size);
+        bench_containers<Point3d>("point3d", size);
+        bench_containers<Bytes64>("bytes64", size);
+    }
+
+    for (std::size_t size : {std::size_t{1000}, std::size_t{100000}, std::size_t{1000000}}) {
+        bench_policies<Int32>("int32", size);
+    }
+
+    bench_dispatches(200000);
+    bench_compaction(512);
+
+    bench_allocators(16, 16, 200000);
+    for (std::size_t max_block : {std::size_t{64}, std::size_t{1024}}) {
+        bench_allocators(1, max_block, 200000);
+    }
+
+    for (std::size_t threads : {std::size_t{1}, std::size_t{2}, std::size_t{4}}) {
+        bench_contention(threads, 400000);
+    }
+    return 0;
+}
@@ -0,0 +1,49 @@
+#ifndef COMPACTING_MEMORY_RESOURCE_HPP
+#define COMPACTING_MEMORY_RESOURCE_HPP
+
+#include "expandable_memory_resource.hpp"
+
+#include <memory_resource>
+
+// Owner of a block that a compacting resource is allowed to move. The callback runs while the
+// resource is locked and must not call back into it.
+class RelocationHandler {
+
+public:
+
+    // The block's bytes have already been copied from old_ptr to new_ptr
+    virtual void relocated(void* old_ptr, void* new_ptr) noexcept = 0;
+
+protected:
+
+    ~RelocationHandler() = default;
+};
+
+// An ExpandableMemoryResource whose compact() pass slides movable blocks together so that the
+// free space between them becomes one gap. Blocks stay pinned unless their owner registers a
+// handler; they are moved bytewise, so only trivially relocatable contents may be registered.
+// Containers check for it with dynamic_cast, like for ExpandableMemoryResource.
+class CompactingMemoryResource: public ExpandableMemoryResource {
+
+public:
+
+    // Lets compact() move the block and report it to handler; nullptr pins the block again.
+    // The registration ends with the block's deallocation. Returns false when the resource cannot
+    // move this block, e.g. a pooled one.
+    bool set_relocation_handler(void* ptr, RelocationHandler* handler,
+                                std::size_t alignment = alignof(std::max_align_t)) {
+        return do_set_relocation_handler(ptr, handler, alignment);
+    }
+
+    // Nothing may use the registered blocks while it runs; returns the number of blocks moved
+    std::size_t compact() {
+        return do_compact();
+    }
+
+private:
+
+    virtual bool do_set_relocation_handler(void* ptr, RelocationHandler* handler, std::size_t alignment) = 0;
+    virtual std::size_t do_compact() = 0;
+};
+
+#endif
@@ -0,0 +1,213 @@
+#ifndef CONCURRENT_CUSTOM_STACK_HPP
+#define CONCURRENT_CUSTOM_STACK_HPP
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <memory_resource>
+#include <memory>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+// Lock-free Treiber stack. Nodes live in segments taken from the allocator and are recycled
+// through a second lock-free list instead of being freed, so a node read by a thread that lost a
+// race is always valid memory. Both list heads pack a 32-bit node index with a 32-bit version
+// tag that changes on every update, which rules out ABA on compare-exchange.
+template <typename T, typename allocator_type>
+requires std::is_same_v<allocator_type, std::pmr::polymorphic_allocator<T>>
+class ConcurrentCustomStack
+{
+    struct Node {
+        alignas(T) unsigned char storage[sizeof(T)];
+        std::atomic<std::uint32_t> next{NIL};
+
+        T* item() {
+            return std::launder(reinterpret_cast<T*>(storage));
+        }
+    };
+
+    using node_allocator_type = std::pmr::polymorphic_allocator<Node>;
+
+private:
+
+    static constexpr std::uint32_t NIL{0xFFFFFFFF};
+    static constexpr std::size_t FIRST_SEGMENT_SIZE{64};
+    static constexpr std::size_t MAX_SEGMENTS{26};
+    // Stands in a segment slot while one thread allocates it; never dereferenced
+    static inline Node installing{};
+
+    node_allocator_type _node_allocator;
+    std::array<std::atomic<Node*>, MAX_SEGMENTS> _segments{};
+    std::atomic<std::uint64_t> _head{__pack(NIL, 0)};
+    std::atomic<std::uint64_t> _free_head{__pack(NIL, 0)};
+    std::atomic<std::uint32_t> _next_unused{0};
+
+public:
+
+    using item_type = T;
+
+    ConcurrentCustomStack(allocator_type alloc = {}) :
+        _node_allocator(alloc.resource()) {
+    }
+
+    ConcurrentCustomStack(const ConcurrentCustomStack&) = delete;
+    ConcurrentCustomStack& operator=(const ConcurrentCustomStack&) = delete;
+
+    ~ConcurrentCustomStack() {
+        for (std::uint32_t index = __pop_index(_head); index != NIL; index = __pop_index(_head)) {
+            std::destroy_at(__node(index).item());
+        }
+        for (std::size_t segment = 0; segment < MAX_SEGMENTS; ++segment) {
+            if (Node* nodes = _segments[segment].load(std::memory_order_relaxed)) {
+                std::destroy_n(nodes, __segment_size(segment));
+                _node_allocator.deallocate(nodes, __segment_size(segment));
+            }
+        }
+    }
+
+private:
+
+    static constexpr std::uint64_t __pack(std::uint32_t index, std::uint32_t tag) {
+        return (static_cast<std::uint64_t>(tag) << 32) | index;
+    }
+
+    static constexpr std::uint32_t __index(std::uint64_t head) {
+        return static_cast<std::uint32_t>(head);
+    }
+
+    static constexpr std::uint32_t __tag(std::uint64_t head) {
+        return static_cast<std::uint32_t>(head >> 32);
+    }
+
+    static constexpr std::size_t __segment_size(std::size_t segment) {
+        return FIRST_SEGMENT_SIZE << segment;
+    }
+
+    // Segment k holds FIRST_SEGMENT_SIZE * 2^k nodes starting at FIRST_SEGMENT_SIZE * (2^k - 1)
+    static constexpr std::size_t __segment_of(std::uint32_t index) {
+        return std::bit_width(index / FIRST_SEGMENT_SIZE + 1) - 1;
+    }
+
+    Node& __node(std::uint32_t index) {
+        std::size_t segment = __segment_of(index);
+        std::size_t offset = index - FIRST_SEGMENT_SIZE * ((std::size_t{1} << segment) - 1);
+        return _segments[segment].load(std::memory_order_acquire)[offset];
+    }
+
+    void __push_index(std::atomic<std::uint64_t>& head, std::uint32_t index) {
+        Node& node = __node(index);
+        std::uint64_t old_head = head.load(std::memory_order_relaxed);
+        do {
+            node.next.store(__index(old_head), std::memory_order_relaxed);
+        } while (!head.compare_exchange_weak(old_head, __pack(index, __tag(old_head) + 1),
+                                             std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    std::uint32_t __pop_index(std::atomic<std::uint64_t>& head) {
+        std::uint64_t old_head = head.load(std::memory_order_acquire);
+        while (__index(old_head) != NIL) {
+            std::uint32_t next = __node(__index(old_head)).next.load(std::memory_order_relaxed);
+            if (head.compare_exchange_weak(old_head, __pack(next, __tag(old_head) + 1),
+                                           std::memory_order_acquire, std::memory_order_acquire)) {
+                return __index(old_head);
+            }
+        }
+        return NIL;
+    }
+
+    // Installs the segment holding index. Only the thread that claims the empty slot allocates,
+    // the others wait for it, so a fixed arena never has to fit two copies of a segment at once.
+    // A failed allocation empties the slot again and the next thread tries on its own
+    void __ensure_segment(std::uint32_t index) {
+        std::size_t segment = __segment_of(index);
+        if (segment >= MAX_SEGMENTS) {
+            throw std::bad_alloc();
+        }
+        std::atomic<Node*>& slot = _segments[segment];
+        Node* nodes = slot.load(std::memory_order_acquire);
+        while (nodes != nullptr || !slot.compare_exchange_weak(nodes, &installing, std::memory_order_acquire)) {
+            if (nodes == &installing) {
+                std::this_thread::yield();
+                nodes = slot.load(std::memory_order_acquire);
+            } else if (nodes != nullptr) {
+                return;
+            }
+        }
+        try {
+            nodes = _node_allocator.allocate(__segment_size(segment));
+        } catch (...) {
+            slot.store(nullptr, std::memory_order_release);
+            throw;
+        }
+        std::uninitialized_default_construct_n(nodes, __segment_size(segment));
+        slot.store(nodes, std::memory_order_release);
+    }
+
+    // An unused index is only taken once its segment exists, so a failed allocation consumes
+    // nothing and no index can ever refer to a missing segment
+    std::uint32_t __acquire_node() {
+        std::uint32_t index = __pop_index(_free_head);
+        if (index != NIL) {
+            return index;
+        }
+        index = _next_unused.load(std::memory_order_relaxed);
+        do {
+            if (index == NIL) {
+                throw std::bad_alloc();
+            }
+            __ensure_segment(index);
+        } while (!_next_unused.compare_exchange_weak(index, index + 1, std::memory_order_relaxed));
+        return index;
+    }
+
+public:
+
+    bool empty() const {
+        return __index(_head.load(std::memory_order_acquire)) == NIL;
+    }
+
+    template<typename... Args>
+    void emplace(Args&&... args) {
+        std::uint32_t index = __acquire_node();
+        try {
+            std::construct_at(__node(index).item(), std::forward<Args>(args)...);
+        } catch (...) {
+            __push_index(_free_head, index);
+            throw;
+        }
+        __push_index(_head, index);
+    }
+
+    void push(const T& item) {
+        emplace(item);
+    }
+
+    void push(T&& item) {
+        emplace(std::move(item));
+    }
+
+    std::optional<T> try_pop() {
+        std::uint32_t index = __pop_index(_head);
+        if (index == NIL) {
+            return std::nullopt;
+        }
+        T* item = __node(index).item();
+        std::optional<T> result(std::move(*item));
+        std::destroy_at(item);
+        __push_index(_free_head, index);
+        return result;
+    }
+
+    void pop() {
+        if (!try_pop()) {
+            throw std::out_of_range("Stack is empty");
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef CONCURRENT_MEMORY_RESOURCE_HPP
+#define CONCURRENT_MEMORY_RESOURCE_HPP
+
+#include "custom_memory_resource.hpp"
+
+#include <memory>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <mutex>
+#include <bit>
+
+// CustomMemoryResource fronted by per-thread magazines of small free blocks. Each thread allocates
+// from and frees into its own magazine and only takes the arena lock to refill or flush half a
+// magazine at once, so threads sharing the resource rarely contend on the mutex.
+template<std::size_t BUFFER_SIZE = 1024>
+class ConcurrentCustomMemoryResource: public std::pmr::memory_resource {
+
+    using Arena = BasicCustomMemoryResource<BUFFER_SIZE>;
+
+    // Magazines cache the arena's own size classes
+    static constexpr std::size_t MIN_SIZE_CLASS{Arena::MIN_SIZE_CLASS};
+    static constexpr std::size_t SIZE_CLASS_COUNT{Arena::SIZE_CLASS_COUNT};
+    static constexpr std::size_t MAX_SIZE_CLASS{Arena::MAX_SIZE_CLASS};
+    static constexpr std::size_t MAX_CACHED_ALIGNMENT{16};
+    static constexpr std::size_t MAGAZINE_CAPACITY{64};
+    static constexpr std::size_t TRANSFER_BATCH{MAGAZINE_CAPACITY / 2};
+
+    // Shared between the resource and the caches pointing at it, outlives whichever dies first
+    struct Registry {
+        std::mutex mutex;
+        Arena* arena{nullptr};
+    };
+
+    struct Magazine {
+        std::array<void*, MAGAZINE_CAPACITY> blocks{};
+        std::size_t count{0};
+    };
+
+    struct ThreadCache {
+        std::shared_ptr<Registry> registry;
+        std::array<Magazine, SIZE_CLASS_COUNT> magazines{};
+
+        ~ThreadCache() {
+            std::lock_guard<std::mutex> lock(registry->mutex);
+            if (registry->arena) {
+                for (std::size_t size_class = 0; size_class < magazines.size(); ++size_class) {
+                    registry->arena->deallocate_bulk(
+                        magazines[size_class].blocks.data(),
+                        magazines[size_class].count,
+                        __class_size(size_class),
+                        __class_alignment(size_class)
+                    );
+                }
+            }
+        }
+    };
+
+    struct ThreadCaches {
+        std::vector<std::unique_ptr<ThreadCache>> caches;
+        ThreadCache* last_used{nullptr};
+    };
+
+private:
+
+    Arena _arena;
+    std::shared_ptr<Registry> _registry;
+
+public:
+
+    explicit ConcurrentCustomMemoryResource(AllocationMode mode = AllocationMode::pool,
+                                            std::pmr::memory_resource* upstream = nullptr) :
+        _arena(mode, upstream),
+        _registry(std::make_shared<Registry>())
+    {
+        _registry->arena = &_arena;
+    }
+
+    ~ConcurrentCustomMemoryResource() override {
+        // Blocks still cached by other threads belong to the arena and vanish with it
+        std::lock_guard<std::mutex> lock(_registry->mutex);
+        _registry->arena = nullptr;
+    }
+
+public:
+
+    Arena& arena() {
+        return _arena;
+    }
+
+    // Returns every block cached by the calling thread to the shared arena
+    void flush_thread_cache() {
+        ThreadCache& cache = __thread_cache();
+        for (std::size_t size_class = 0; size_class < SIZE_CLASS_COUNT; ++size_class) {
+            Magazine& magazine = cache.magazines[size_class];
+            _arena.deallocate_bulk(magazine.blocks.data(), magazine.count,
+                                   __class_size(size_class), __class_alignment(size_class));
+            magazine.count = 0;
+        }
+    }
+
+private:
+
+    static std::size_t __size_class(std::size_t bytes) {
+        if (bytes <= MIN_SIZE_CLASS) {
+            return 0;
+        }
+        return std::bit_width(bytes - 1) - std::bit_width(MIN_SIZE_CLASS - 1);
+    }
+
+    static std::size_t __class_size(std::size_t size_class) {
+        return MIN_SIZE_CLASS << size_class;
+    }
+
+    static std::size_t __class_alignment(std::size_t size_class) {
+        return std::min(__class_size(size_class), MAX_CACHED_ALIGNMENT);
+    }
+
+    static bool __is_cached(std::size_t bytes, std::size_t alignment) {
+        return bytes <= MAX_SIZE_CLASS && alignment <= MAX_CACHED_ALIGNMENT;
+    }
+
+    ThreadCache& __thread_cache() {
+        static thread_local ThreadCaches thread_caches;
+        if (thread_caches.last_used && thread_caches.last_used->registry == _registry) {
+            return *thread_caches.last_used;
+        }
+        std::erase_if(thread_caches.caches, [](const std::unique_ptr<ThreadCache>& cache) {
+            std::lock_guard<std::mutex> lock(cache->registry->mutex);
+            return cache->registry->arena == nullptr;
+        });
+        auto found = std::find_if(thread_caches.caches.begin(), thread_caches.caches.end(),
+            [this](const std::unique_ptr<ThreadCache>& cache) {
+                return cache->registry == _registry;
+            });
+        if (found == thread_caches.caches.end()) {
+            thread_caches.caches.push_back(std::make_unique<ThreadCache>());
+            thread_caches.caches.back()->registry = _registry;
+            found = std::prev(thread_caches.caches.end());
+        }
+        thread_caches.last_used = found->get();
+        return *thread_caches.last_used;
+    }
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        if (!__is_cached(bytes, alignment)) {
+            return _arena.allocate(bytes, alignment);
+        }
+        std::size_t size_class = __size_class(std::max({bytes, alignment, std::size_t{1}}));
+        Magazine& magazine = __thread_cache().magazines[size_class];
+        if (magazine.count == 0) {
+            magazine.count = _arena.allocate_bulk(__class_size(size_class), __class_alignment(size_class),
+                                                  magazine.blocks.data(), TRANSFER_BATCH);
+            if (magazine.count == 0) {
+                throw std::bad_alloc();
+            }
+        }
+        return magazine.blocks[--magazine.count];
+    }
+
+    void do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment) override {
+        if (!__is_cached(bytes, alignment)) {
+            _arena.deallocate(ptr, bytes, alignment);
+            return;
+        }
+        std::size_t size_class = __size_class(std::max({bytes, alignment, std::size_t{1}}));
+        Magazine& magazine = __thread_cache().magazines[size_class];
+        if (magazine.count == MAGAZINE_CAPACITY) {
+            magazine.count -= TRANSFER_BATCH;
+            _arena.deallocate_bulk(magazine.blocks.data() + magazine.count, TRANSFER_BATCH,
+                                   __class_size(size_class), __class_alignment(size_class));
+        }
+        magazine.blocks[magazine.count++] = ptr;
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+#endif
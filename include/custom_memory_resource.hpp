@@ -1,99 +1,928 @@
-#ifndef CUSTOM_ALLOCATOR_HPP
-#define CUSTOM_ALLOCATOR_HPP
-
-#include <memory_resource>
-#include <memory>
-#include <vector>
-#include <exception>
-#include <mutex>
-#include <iostream>
-
-class CustomMemoryResource: public std::pmr::memory_resource {
-
-    struct MemoryBlock {
-        size_t offset{0};
-        size_t size{0};
-    };
-
-private:
-
-    static constexpr std::size_t BUFFER_SIZE{1024};
-    alignas(16) char _buffer[BUFFER_SIZE];
-    std::vector<MemoryBlock> _used_blocks{{BUFFER_SIZE, 0}};
-    std::mutex _mutex;
-
-public:
-
-    ~CustomMemoryResource() override = default;
-
-public:
-
-    std::size_t _get_buffer_size() const {
-        return BUFFER_SIZE;
-    }
-
-private:
-
-    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
-        std::lock_guard<std::mutex> lock(_mutex);
-        // std::cout << "TRY: Allocation: size: " << bytes << " bytes" << std::endl;
-        if (bytes == 0) {
-            bytes = 1;
-        }
-        std::size_t allocation_offset{0};
-        std::size_t index{0};
-        for (const MemoryBlock& used_block : _used_blocks) {
-            void *tmp_ptr = _buffer + allocation_offset;
-            std::size_t space = used_block.offset - allocation_offset;
-            std::size_t remained_space{space};
-            void *aligned_ptr = std::align(alignment, bytes, tmp_ptr, remained_space);
-            if (aligned_ptr) {
-                allocation_offset += space - remained_space;
-                _used_blocks.emplace(
-                    _used_blocks.begin() + index,
-                    allocation_offset,
-                    bytes
-                );
-                // std::cout << "Allocation: offset " << allocation_offset << ", size " << bytes << " bytes" << std::endl;
-                return _buffer + allocation_offset;
-            }
-            allocation_offset = used_block.offset + used_block.size;
-            ++index;
-        }
-        throw std::bad_alloc();
-    }
-
-    void do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment) override {
-        std::lock_guard<std::mutex> lock(_mutex);
-        // std::cout << "TRY: Free: address " << ptr << ", size " << bytes << " bytes" << std::endl;
-        if (bytes == 0) {
-            bytes = 1;
-        }
-        std::size_t a{0};
-        std::size_t b{_used_blocks.size() - 2};
-        while (a <= b) {
-            std::size_t k{(a + b) / 2};
-            void* current_ptr = static_cast<void*>(_buffer + _used_blocks[k].offset);
-            if (ptr == current_ptr) {
-                if (_used_blocks[k].size != bytes) {
-                    throw std::logic_error("An attempt to free an incorrectly sized block.");
-                }
-                // std::cout << "Free: address " << ptr << ", offset: " << _used_blocks[k].offset << ", size " << bytes << " bytes" << std::endl;
-                _used_blocks.erase(_used_blocks.begin() + k);
-                return;
-            }
-            if (ptr < current_ptr) {
-                b = k - 1;
-            } else {
-                a = k + 1;
-            }
-        }
-        throw std::logic_error("An attempt to free an unallocated block.");
-    }
-
-    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
-        return this == &other;
-    }
-};
-
-#endif
\ No newline at end of file
+#ifndef CUSTOM_ALLOCATOR_HPP
+#define CUSTOM_ALLOCATOR_HPP
+
+#include "compacting_memory_resource.hpp"
+
+#include <memory_resource>
+#include <memory>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <mutex>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+#include <new>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+enum class AllocationMode {
+    first_fit,  // linear scan over the used blocks, the tightest packing
+    pool,       // segregated free lists for small sizes, O(1) allocate/free
+    bitmap      // fixed-size slots tracked by one bit each, for uniform request sizes
+};
+
+// Snapshot of a resource. The counters are maintained only when CUSTOM_MEMORY_RESOURCE_STATS is
+// defined; the free space figures are computed from the block metadata on every snapshot.
+struct MemoryResourceStatistics {
+    static constexpr std::size_t HISTOGRAM_BUCKETS{16};
+
+    bool counters_enabled{false};
+    std::size_t allocations{0};
+    std::size_t deallocations{0};
+    std::size_t failed_allocations{0};
+    std::size_t bytes_in_use{0};
+    std::size_t peak_bytes_in_use{0};
+    // Bucket i counts requests of (2^(i-1), 2^i] bytes, the last bucket also takes everything larger
+    std::array<std::size_t, HISTOGRAM_BUCKETS> size_histogram{};
+    std::size_t capacity{0};
+    std::size_t free_bytes{0};
+    std::size_t largest_free_gap{0};
+    // 1 - largest_free_gap / free_bytes: 0 when all free space is one gap, close to 1 when it is scattered
+    double external_fragmentation{0};
+
+    static std::size_t histogram_bucket(std::size_t bytes) {
+        return std::min<std::size_t>(std::bit_width(bytes - 1), HISTOGRAM_BUCKETS - 1);
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const MemoryResourceStatistics& statistics) {
+        os << "capacity:               " << statistics.capacity << " bytes\n"
+           << "free:                   " << statistics.free_bytes << " bytes\n"
+           << "largest free gap:       " << statistics.largest_free_gap << " bytes\n"
+           << "external fragmentation: " << std::fixed << std::setprecision(3)
+           << statistics.external_fragmentation << "\n";
+        if (!statistics.counters_enabled) {
+            return os << "counters:               disabled (define CUSTOM_MEMORY_RESOURCE_STATS)\n";
+        }
+        os << "allocations:            " << statistics.allocations << "\n"
+           << "deallocations:          " << statistics.deallocations << "\n"
+           << "failed allocations:     " << statistics.failed_allocations << "\n"
+           << "bytes in use:           " << statistics.bytes_in_use << "\n"
+           << "peak bytes in use:      " << statistics.peak_bytes_in_use << "\n"
+           << "size histogram:\n";
+        for (std::size_t bucket = 0; bucket < HISTOGRAM_BUCKETS; ++bucket) {
+            if (statistics.size_histogram[bucket] != 0) {
+                os << (bucket + 1 == HISTOGRAM_BUCKETS ? "  >  " : "  <= ")
+                   << std::setw(6) << (std::size_t{1} << (bucket + 1 == HISTOGRAM_BUCKETS ? bucket - 1 : bucket))
+                   << ": " << statistics.size_histogram[bucket] << "\n";
+            }
+        }
+        return os;
+    }
+};
+
+template<std::size_t BUFFER_SIZE = 1024>
+class BasicCustomMemoryResource: public CompactingMemoryResource {
+
+    struct MemoryBlock {
+        size_t offset{0};
+        size_t size{0};
+    };
+
+    // A block that compact() may move, for as long as its owner keeps the handler registered
+    struct Relocation {
+        size_t offset{0};
+        RelocationHandler* owner{nullptr};
+        size_t alignment{1};
+    };
+
+    struct FreeNode {
+        FreeNode* next{nullptr};
+    };
+
+    // A fixed-size page carved out of a chunk and split into equal blocks of one size class
+    struct Slab {
+        char* address{nullptr};
+        std::size_t size_class{NO_SIZE_CLASS};
+        std::size_t live_blocks{0};
+        std::size_t carved_blocks{0};
+        FreeNode* free_list{nullptr};
+        Slab* prev_partial{nullptr};
+        Slab* next_partial{nullptr};
+    };
+
+    // A contiguous region managed by first-fit: the inline buffer or a block taken from upstream
+    struct Chunk {
+        char* data{nullptr};
+        std::size_t size{0};
+        std::vector<MemoryBlock> used_blocks;
+        // Sorted by offset like used_blocks; empty unless some owner registered a handler
+        std::vector<Relocation> relocations;
+        std::uintptr_t slab_base{0};
+        std::vector<Slab> slabs;
+        // Bitmap mode: bit i is set while slot i is taken; words before free_hint are full
+        std::vector<std::uint64_t> bitmap;
+        std::size_t slot_count{0};
+        std::size_t free_hint{0};
+    };
+
+public:
+
+    // Pool mode serves requests up to MAX_SIZE_CLASS from power-of-two size classes
+    static constexpr std::size_t MIN_SIZE_CLASS{8};
+    static constexpr std::size_t SIZE_CLASS_COUNT{5};
+    static constexpr std::size_t MAX_SIZE_CLASS{MIN_SIZE_CLASS << (SIZE_CLASS_COUNT - 1)};
+
+private:
+
+    static constexpr std::size_t NO_SIZE_CLASS{SIZE_CLASS_COUNT};
+    static constexpr std::size_t SLAB_SIZE{MAX_SIZE_CLASS};
+    static constexpr std::size_t MAX_POOL_ALIGNMENT{16};
+    static constexpr std::size_t GROWTH_FACTOR{2};
+    static constexpr std::size_t WORD_BITS{64};
+    static constexpr std::uint64_t FULL_WORD{~std::uint64_t{0}};
+
+    static_assert(BUFFER_SIZE > 0, "The inline buffer must not be empty");
+
+    alignas(16) char _buffer[BUFFER_SIZE];
+    std::vector<Chunk> _chunks;
+    std::mutex _mutex;
+    AllocationMode _mode;
+    std::pmr::memory_resource* _upstream;
+    std::size_t _slot_size;
+    std::array<Slab*, SIZE_CLASS_COUNT> _partial_slabs{};
+#ifdef CUSTOM_MEMORY_RESOURCE_STATS
+    MemoryResourceStatistics _statistics{true};
+#endif
+
+public:
+
+    // Without an upstream resource the arena is fixed to the inline buffer and an allocation that
+    // does not fit throws std::bad_alloc; with one, geometrically larger chunks are borrowed from it.
+    // In bitmap mode every request takes whole slots of slot_size bytes, one when it fits a slot.
+    explicit BasicCustomMemoryResource(AllocationMode mode = AllocationMode::first_fit,
+                                       std::pmr::memory_resource* upstream = nullptr,
+                                       std::size_t slot_size = 16) :
+        _mode(mode),
+        _upstream(upstream),
+        _slot_size(slot_size)
+    {
+        if (_slot_size == 0) {
+            throw std::invalid_argument("The slot size must not be zero.");
+        }
+        __add_chunk(_buffer, BUFFER_SIZE);
+    }
+
+    ~BasicCustomMemoryResource() override {
+        for (std::size_t chunk_index = 1; chunk_index < _chunks.size(); ++chunk_index) {
+            _upstream->deallocate(_chunks[chunk_index].data, _chunks[chunk_index].size, SLAB_SIZE);
+        }
+    }
+
+public:
+
+    std::size_t _get_buffer_size() const {
+        return BUFFER_SIZE;
+    }
+
+    AllocationMode mode() const {
+        return _mode;
+    }
+
+    std::pmr::memory_resource* upstream_resource() const {
+        return _upstream;
+    }
+
+    std::size_t slot_size() const {
+        return _slot_size;
+    }
+
+    std::size_t chunk_count() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _chunks.size();
+    }
+
+    std::size_t capacity() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::size_t total{0};
+        for (const Chunk& chunk : _chunks) {
+            total += chunk.size;
+        }
+        return total;
+    }
+
+    MemoryResourceStatistics statistics() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        MemoryResourceStatistics snapshot;
+#ifdef CUSTOM_MEMORY_RESOURCE_STATS
+        snapshot = _statistics;
+#endif
+        for (const Chunk& chunk : _chunks) {
+            snapshot.capacity += chunk.size;
+            if (_mode == AllocationMode::bitmap) {
+                for (std::size_t first = __next_free_slot(chunk, 0); first < chunk.slot_count;) {
+                    std::size_t end = __next_used_slot(chunk, first, chunk.slot_count);
+                    snapshot.free_bytes += (end - first) * _slot_size;
+                    snapshot.largest_free_gap = std::max(snapshot.largest_free_gap, (end - first) * _slot_size);
+                    first = __next_free_slot(chunk, end);
+                }
+                continue;
+            }
+            std::size_t gap_start{0};
+            for (const MemoryBlock& used_block : chunk.used_blocks) {
+                std::size_t gap = used_block.offset - gap_start;
+                snapshot.free_bytes += gap;
+                snapshot.largest_free_gap = std::max(snapshot.largest_free_gap, gap);
+                gap_start = used_block.offset + used_block.size;
+            }
+        }
+        if (snapshot.free_bytes != 0) {
+            snapshot.external_fragmentation =
+                1.0 - static_cast<double>(snapshot.largest_free_gap) / static_cast<double>(snapshot.free_bytes);
+        }
+        return snapshot;
+    }
+
+    void dump_statistics(std::ostream& os = std::cout) {
+        os << statistics();
+    }
+
+    // Allocates up to count equally sized blocks under a single lock and returns how many were obtained
+    std::size_t allocate_bulk(std::size_t bytes, std::size_t alignment, void** blocks, std::size_t count) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::size_t allocated{0};
+        try {
+            for (; allocated < count; ++allocated) {
+                blocks[allocated] = __allocate(bytes, alignment);
+            }
+        } catch (const std::bad_alloc&) {
+        }
+        return allocated;
+    }
+
+    void deallocate_bulk(void* const* blocks, std::size_t count, std::size_t bytes, std::size_t alignment) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (std::size_t block_index = 0; block_index < count; ++block_index) {
+            __deallocate(blocks[block_index], bytes, alignment);
+        }
+    }
+
+    // Non-virtual counterparts of allocate/deallocate/try_expand for callers that know the
+    // concrete resource type, such as CustomAllocator, so that the calls can be inlined
+    void* allocate_direct(std::size_t bytes, std::size_t alignment = alignof(std::max_align_t)) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return __allocate(bytes, alignment);
+    }
+
+    void deallocate_direct(void* ptr, std::size_t bytes, std::size_t alignment = alignof(std::max_align_t)) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        __deallocate(ptr, bytes, alignment);
+    }
+
+    bool try_expand_direct(void* ptr, std::size_t old_size, std::size_t new_size,
+                           std::size_t alignment = alignof(std::max_align_t)) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return __try_expand(ptr, old_size, new_size, alignment);
+    }
+
+private:
+
+    static std::size_t __size_class(std::size_t bytes) {
+        if (bytes <= MIN_SIZE_CLASS) {
+            return 0;
+        }
+        return std::bit_width(bytes - 1) - std::bit_width(MIN_SIZE_CLASS - 1);
+    }
+
+    static std::size_t __class_size(std::size_t size_class) {
+        return MIN_SIZE_CLASS << size_class;
+    }
+
+    bool __is_pooled(std::size_t bytes, std::size_t alignment) const {
+        return _mode == AllocationMode::pool && bytes <= MAX_SIZE_CLASS && alignment <= MAX_POOL_ALIGNMENT;
+    }
+
+    Chunk& __add_chunk(char* data, std::size_t size) {
+        Chunk& chunk = _chunks.emplace_back();
+        chunk.data = data;
+        chunk.size = size;
+        chunk.used_blocks.push_back({size, 0});
+        if (_mode == AllocationMode::pool) {
+            chunk.slab_base = reinterpret_cast<std::uintptr_t>(data) & ~(SLAB_SIZE - 1);
+            chunk.slabs.resize(size / SLAB_SIZE + 1);
+            for (std::size_t slab_index = 0; slab_index < chunk.slabs.size(); ++slab_index) {
+                chunk.slabs[slab_index].address = reinterpret_cast<char*>(chunk.slab_base + slab_index * SLAB_SIZE);
+            }
+        }
+        if (_mode == AllocationMode::bitmap) {
+            chunk.slot_count = size / _slot_size;
+            chunk.bitmap.assign((chunk.slot_count + WORD_BITS - 1) / WORD_BITS, 0);
+            // Bits past the last slot stay set so that no search ever returns them
+            if (chunk.slot_count % WORD_BITS != 0) {
+                chunk.bitmap.back() = FULL_WORD << (chunk.slot_count % WORD_BITS);
+            }
+        }
+        return chunk;
+    }
+
+    Chunk* __chunk_of(const void* ptr) {
+        for (Chunk& chunk : _chunks) {
+            if (ptr >= chunk.data && ptr < chunk.data + chunk.size) {
+                return &chunk;
+            }
+        }
+        return nullptr;
+    }
+
+    Slab& __slab_of(Chunk& chunk, const void* ptr) {
+        return chunk.slabs[(reinterpret_cast<std::uintptr_t>(ptr) - chunk.slab_base) / SLAB_SIZE];
+    }
+
+    void __link_partial(Slab& slab) {
+        Slab*& head = _partial_slabs[slab.size_class];
+        slab.prev_partial = nullptr;
+        slab.next_partial = head;
+        if (head) {
+            head->prev_partial = &slab;
+        }
+        head = &slab;
+    }
+
+    void __unlink_partial(Slab& slab) {
+        if (slab.prev_partial) {
+            slab.prev_partial->next_partial = slab.next_partial;
+        } else {
+            _partial_slabs[slab.size_class] = slab.next_partial;
+        }
+        if (slab.next_partial) {
+            slab.next_partial->prev_partial = slab.prev_partial;
+        }
+        slab.prev_partial = nullptr;
+        slab.next_partial = nullptr;
+    }
+
+    static void* __first_fit_allocate(Chunk& chunk, std::size_t bytes, std::size_t alignment) {
+        std::size_t allocation_offset{0};
+        std::size_t index{0};
+        for (const MemoryBlock& used_block : chunk.used_blocks) {
+            void *tmp_ptr = chunk.data + allocation_offset;
+            std::size_t space = used_block.offset - allocation_offset;
+            std::size_t remained_space{space};
+            void *aligned_ptr = std::align(alignment, bytes, tmp_ptr, remained_space);
+            if (aligned_ptr) {
+                allocation_offset += space - remained_space;
+                chunk.used_blocks.emplace(
+                    chunk.used_blocks.begin() + index,
+                    allocation_offset,
+                    bytes
+                );
+                return chunk.data + allocation_offset;
+            }
+            allocation_offset = used_block.offset + used_block.size;
+            ++index;
+        }
+        return nullptr;
+    }
+
+    static std::size_t __find_block(const Chunk& chunk, const void* ptr) {
+        std::size_t a{0};
+        std::size_t b{chunk.used_blocks.size() - 2};
+        while (a <= b && b < chunk.used_blocks.size()) {
+            std::size_t k{(a + b) / 2};
+            const void* current_ptr = static_cast<const void*>(chunk.data + chunk.used_blocks[k].offset);
+            if (ptr == current_ptr) {
+                return k;
+            }
+            if (ptr < current_ptr) {
+                b = k - 1;
+            } else {
+                a = k + 1;
+            }
+        }
+        throw std::logic_error("An attempt to free an unallocated block.");
+    }
+
+    static void __first_fit_deallocate(Chunk& chunk, void* ptr, std::size_t bytes) {
+        std::size_t k = __find_block(chunk, ptr);
+        if (chunk.used_blocks[k].size != bytes) {
+            throw std::logic_error("An attempt to free an incorrectly sized block.");
+        }
+        if (!chunk.relocations.empty()) {
+            auto relocation = __find_relocation(chunk, chunk.used_blocks[k].offset);
+            if (relocation != chunk.relocations.end() && relocation->offset == chunk.used_blocks[k].offset) {
+                chunk.relocations.erase(relocation);
+            }
+        }
+        chunk.used_blocks.erase(chunk.used_blocks.begin() + k);
+    }
+
+    static typename std::vector<Relocation>::iterator __find_relocation(Chunk& chunk, std::size_t offset) {
+        return std::lower_bound(chunk.relocations.begin(), chunk.relocations.end(), offset,
+                                [](const Relocation& relocation, std::size_t value) { return relocation.offset < value; });
+    }
+
+    // The block may take over the gap up to its successor (the sentinel bounds the last one)
+    static bool __first_fit_expand(Chunk& chunk, void* ptr, std::size_t old_size, std::size_t new_size) {
+        std::size_t k = __find_block(chunk, ptr);
+        MemoryBlock& block = chunk.used_blocks[k];
+        if (block.size != old_size) {
+            throw std::logic_error("An attempt to expand an incorrectly sized block.");
+        }
+        if (chunk.used_blocks[k + 1].offset - block.offset < new_size) {
+            return false;
+        }
+        block.size = new_size;
+        return true;
+    }
+
+    // Gives fully free slabs back to the first-fit region, returns true if any was released
+    bool __release_empty_slabs() {
+        bool released{false};
+        for (Chunk& chunk : _chunks) {
+            for (Slab& slab : chunk.slabs) {
+                if (slab.size_class != NO_SIZE_CLASS && slab.live_blocks == 0) {
+                    __unlink_partial(slab);
+                    __first_fit_deallocate(chunk, slab.address, SLAB_SIZE);
+                    slab = Slab{slab.address};
+                    released = true;
+                }
+            }
+        }
+        return released;
+    }
+
+    void* __try_allocate_region(std::size_t bytes, std::size_t alignment) {
+        for (Chunk& chunk : _chunks) {
+            if (void* ptr = __first_fit_allocate(chunk, bytes, alignment)) {
+                return ptr;
+            }
+        }
+        return nullptr;
+    }
+
+    // Borrows a chunk from upstream that is at least GROWTH_FACTOR times larger than the last one
+    void* __grow(std::size_t bytes, std::size_t alignment) {
+        std::size_t chunk_size = std::max(_chunks.back().size * GROWTH_FACTOR, bytes + alignment);
+        chunk_size = (chunk_size + SLAB_SIZE - 1) & ~(SLAB_SIZE - 1);
+        char* data = static_cast<char*>(_upstream->allocate(chunk_size, SLAB_SIZE));
+        try {
+            Chunk& chunk = __add_chunk(data, chunk_size);
+            if (_mode == AllocationMode::bitmap) {
+                return __bitmap_allocate_in(chunk, bytes, alignment);
+            }
+            return __first_fit_allocate(chunk, bytes, alignment);
+        } catch (...) {
+            _upstream->deallocate(data, chunk_size, SLAB_SIZE);
+            throw;
+        }
+    }
+
+    void* __allocate_region(std::size_t bytes, std::size_t alignment) {
+        void* ptr = __try_allocate_region(bytes, alignment);
+        if (!ptr && _mode == AllocationMode::pool && __release_empty_slabs()) {
+            ptr = __try_allocate_region(bytes, alignment);
+        }
+        if (!ptr && _upstream) {
+            ptr = __grow(bytes, alignment);
+        }
+        if (!ptr) {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+
+    void* __pool_allocate(std::size_t size_class) {
+        Slab* slab = _partial_slabs[size_class];
+        if (!slab) {
+            void* slab_address = __allocate_region(SLAB_SIZE, SLAB_SIZE);
+            slab = &__slab_of(*__chunk_of(slab_address), slab_address);
+            slab->size_class = size_class;
+            __link_partial(*slab);
+        }
+        void* ptr;
+        if (slab->free_list) {
+            ptr = slab->free_list;
+            slab->free_list = slab->free_list->next;
+        } else {
+            ptr = slab->address + slab->carved_blocks * __class_size(size_class);
+            ++slab->carved_blocks;
+        }
+        ++slab->live_blocks;
+        if (!slab->free_list && slab->carved_blocks == SLAB_SIZE / __class_size(size_class)) {
+            __unlink_partial(*slab);
+        }
+        return ptr;
+    }
+
+    void __pool_deallocate(Chunk& chunk, void* ptr, std::size_t size_class) {
+        Slab& slab = __slab_of(chunk, ptr);
+        std::size_t slab_offset = static_cast<std::size_t>(static_cast<char*>(ptr) - slab.address);
+        if (slab.size_class != size_class || slab.live_blocks == 0 ||
+            slab_offset % __class_size(size_class) != 0) {
+            throw std::logic_error("An attempt to free an incorrectly sized block.");
+        }
+        bool was_full = !slab.free_list && slab.carved_blocks == SLAB_SIZE / __class_size(size_class);
+        slab.free_list = ::new (ptr) FreeNode{slab.free_list};
+        --slab.live_blocks;
+        if (was_full) {
+            __link_partial(slab);
+        }
+    }
+
+    // Index of the first word at or after first with a zero bit, or count when all are full;
+    // whole runs of full words are skipped several words per comparison where SIMD is available
+    static std::size_t __find_non_full_word(const std::uint64_t* words, std::size_t first, std::size_t count) {
+#if defined(__AVX2__)
+        const __m256i full = _mm256_set1_epi64x(-1);
+        for (; first + 4 <= count; first += 4) {
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + first));
+            if (_mm256_movemask_epi8(_mm256_cmpeq_epi64(block, full)) != -1) {
+                break;
+            }
+        }
+#elif defined(__SSE2__)
+        const __m128i full = _mm_set1_epi32(-1);
+        for (; first + 4 <= count; first += 4) {
+            __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words + first));
+            __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words + first + 2));
+            __m128i both = _mm_and_si128(_mm_cmpeq_epi32(low, full), _mm_cmpeq_epi32(high, full));
+            if (_mm_movemask_epi8(both) != 0xFFFF) {
+                break;
+            }
+        }
+#endif
+        while (first < count && words[first] == FULL_WORD) {
+            ++first;
+        }
+        return first;
+    }
+
+    static std::size_t __next_free_slot(const Chunk& chunk, std::size_t slot) {
+        if (slot >= chunk.slot_count) {
+            return chunk.slot_count;
+        }
+        std::size_t word = slot / WORD_BITS;
+        std::uint64_t free_bits = ~chunk.bitmap[word] >> (slot % WORD_BITS);
+        if (free_bits) {
+            return std::min(chunk.slot_count, slot + std::countr_zero(free_bits));
+        }
+        word = __find_non_full_word(chunk.bitmap.data(), word + 1, chunk.bitmap.size());
+        if (word == chunk.bitmap.size()) {
+            return chunk.slot_count;
+        }
+        return std::min(chunk.slot_count, word * WORD_BITS + std::countr_one(chunk.bitmap[word]));
+    }
+
+    // First taken slot in [slot, limit), or limit
+    static std::size_t __next_used_slot(const Chunk& chunk, std::size_t slot, std::size_t limit) {
+        while (slot < limit) {
+            std::uint64_t used_bits = chunk.bitmap[slot / WORD_BITS] >> (slot % WORD_BITS);
+            if (used_bits) {
+                return std::min(limit, slot + std::countr_zero(used_bits));
+            }
+            slot = (slot / WORD_BITS + 1) * WORD_BITS;
+        }
+        return limit;
+    }
+
+    static void __mark_slots(Chunk& chunk, std::size_t first, std::size_t count, bool used) {
+        while (count != 0) {
+            std::size_t shift = first % WORD_BITS;
+            std::size_t bits = std::min(count, WORD_BITS - shift);
+            std::uint64_t mask = (bits == WORD_BITS ? FULL_WORD : ((std::uint64_t{1} << bits) - 1)) << shift;
+            if (used) {
+                chunk.bitmap[first / WORD_BITS] |= mask;
+            } else {
+                chunk.bitmap[first / WORD_BITS] &= ~mask;
+            }
+            first += bits;
+            count -= bits;
+        }
+    }
+
+    std::size_t __slots_for(std::size_t bytes) const {
+        return bytes / _slot_size + (bytes % _slot_size != 0);
+    }
+
+    // First fit over runs of free slots; a single aligned slot is one word scan and a countr_one
+    void* __bitmap_allocate_in(Chunk& chunk, std::size_t bytes, std::size_t alignment) {
+        std::size_t count = __slots_for(bytes);
+        std::size_t first = __next_free_slot(chunk, chunk.free_hint * WORD_BITS);
+        chunk.free_hint = first / WORD_BITS;
+        while (first + count <= chunk.slot_count) {
+            char* address = chunk.data + first * _slot_size;
+            if (reinterpret_cast<std::uintptr_t>(address) % alignment != 0) {
+                first = __next_free_slot(chunk, first + 1);
+                continue;
+            }
+            std::size_t end = count == 1 ? first + 1 : __next_used_slot(chunk, first, first + count);
+            if (end == first + count) {
+                __mark_slots(chunk, first, count, true);
+                return address;
+            }
+            first = __next_free_slot(chunk, end);
+        }
+        return nullptr;
+    }
+
+    void* __bitmap_allocate(std::size_t bytes, std::size_t alignment) {
+        // Keeps the slot and chunk arithmetic below from wrapping around
+        if (__slots_for(bytes) > (std::numeric_limits<std::size_t>::max() - alignment - SLAB_SIZE) / _slot_size) {
+            throw std::bad_alloc();
+        }
+        for (Chunk& chunk : _chunks) {
+            if (void* ptr = __bitmap_allocate_in(chunk, bytes, alignment)) {
+                return ptr;
+            }
+        }
+        if (!_upstream) {
+            throw std::bad_alloc();
+        }
+        if (void* ptr = __grow(__slots_for(bytes) * _slot_size, alignment)) {
+            return ptr;
+        }
+        throw std::bad_alloc();
+    }
+
+    std::size_t __bitmap_slot_of(const Chunk& chunk, const void* ptr, std::size_t bytes) const {
+        std::size_t offset = static_cast<std::size_t>(static_cast<const char*>(ptr) - chunk.data);
+        std::size_t first = offset / _slot_size;
+        if (offset % _slot_size != 0 || first >= chunk.slot_count || __slots_for(bytes) > chunk.slot_count - first ||
+            __next_free_slot(chunk, first) < first + __slots_for(bytes)) {
+            throw std::logic_error("An attempt to free an unallocated block.");
+        }
+        return first;
+    }
+
+    void __bitmap_deallocate(Chunk& chunk, void* ptr, std::size_t bytes) {
+        std::size_t first = __bitmap_slot_of(chunk, ptr, bytes);
+        __mark_slots(chunk, first, __slots_for(bytes), false);
+        chunk.free_hint = std::min(chunk.free_hint, first / WORD_BITS);
+    }
+
+    bool __bitmap_expand(Chunk& chunk, void* ptr, std::size_t old_size, std::size_t new_size) {
+        std::size_t first = __bitmap_slot_of(chunk, ptr, old_size);
+        if (__slots_for(new_size) > chunk.slot_count - first) {
+            return false;
+        }
+        std::size_t old_end = first + __slots_for(old_size);
+        std::size_t new_end = first + __slots_for(new_size);
+        if (__next_used_slot(chunk, old_end, new_end) != new_end) {
+            return false;
+        }
+        __mark_slots(chunk, old_end, new_end - old_end, true);
+        return true;
+    }
+
+    void __record_allocation([[maybe_unused]] std::size_t bytes, [[maybe_unused]] bool succeeded) {
+#ifdef CUSTOM_MEMORY_RESOURCE_STATS
+        if (!succeeded) {
+            ++_statistics.failed_allocations;
+            return;
+        }
+        ++_statistics.allocations;
+        ++_statistics.size_histogram[MemoryResourceStatistics::histogram_bucket(bytes)];
+        _statistics.bytes_in_use += bytes;
+        _statistics.peak_bytes_in_use = std::max(_statistics.peak_bytes_in_use, _statistics.bytes_in_use);
+#endif
+    }
+
+    void __record_deallocation([[maybe_unused]] std::size_t bytes) {
+#ifdef CUSTOM_MEMORY_RESOURCE_STATS
+        ++_statistics.deallocations;
+        _statistics.bytes_in_use -= bytes;
+#endif
+    }
+
+    void __record_expansion([[maybe_unused]] std::size_t old_size, [[maybe_unused]] std::size_t new_size) {
+#ifdef CUSTOM_MEMORY_RESOURCE_STATS
+        _statistics.bytes_in_use += new_size - old_size;
+        _statistics.peak_bytes_in_use = std::max(_statistics.peak_bytes_in_use, _statistics.bytes_in_use);
+#endif
+    }
+
+    void* __allocate(std::size_t bytes, std::size_t alignment) {
+        if (bytes == 0) {
+            bytes = 1;
+        }
+        void* ptr;
+        try {
+            if (_mode == AllocationMode::bitmap) {
+                ptr = __bitmap_allocate(bytes, alignment);
+            } else if (__is_pooled(bytes, alignment)) {
+                ptr = __pool_allocate(__size_class(std::max(bytes, alignment)));
+            } else {
+                ptr = __allocate_region(bytes, alignment);
+            }
+        } catch (const std::bad_alloc&) {
+            __record_allocation(bytes, false);
+            throw;
+        }
+        __record_allocation(bytes, true);
+        return ptr;
+    }
+
+    void __deallocate(void* ptr, std::size_t bytes, std::size_t alignment) {
+        if (bytes == 0) {
+            bytes = 1;
+        }
+        Chunk* chunk = __chunk_of(ptr);
+        if (!chunk) {
+            throw std::logic_error("An attempt to free an unallocated block.");
+        }
+        if (_mode == AllocationMode::bitmap) {
+            __bitmap_deallocate(*chunk, ptr, bytes);
+        } else if (__is_pooled(bytes, alignment)) {
+            __pool_deallocate(*chunk, ptr, __size_class(std::max(bytes, alignment)));
+        } else {
+            __first_fit_deallocate(*chunk, ptr, bytes);
+        }
+        __record_deallocation(bytes);
+    }
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        // std::cout << "TRY: Allocation: size: " << bytes << " bytes" << std::endl;
+        return __allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment) override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        // std::cout << "TRY: Free: address " << ptr << ", size " << bytes << " bytes" << std::endl;
+        __deallocate(ptr, bytes, alignment);
+    }
+
+    bool do_try_expand(void* ptr, std::size_t old_size, std::size_t new_size, std::size_t alignment) override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return __try_expand(ptr, old_size, new_size, alignment);
+    }
+
+    bool __try_expand(void* ptr, std::size_t old_size, std::size_t new_size, std::size_t alignment) {
+        old_size = std::max<std::size_t>(old_size, 1);
+        if (new_size <= old_size) {
+            return new_size == old_size;
+        }
+        Chunk* chunk = __chunk_of(ptr);
+        if (!chunk) {
+            throw std::logic_error("An attempt to expand an unallocated block.");
+        }
+        bool expanded;
+        if (_mode == AllocationMode::bitmap) {
+            expanded = __bitmap_expand(*chunk, ptr, old_size, new_size);
+        } else if (__is_pooled(old_size, alignment)) {
+            // A pooled block only grows within the slack of its size class
+            expanded = __is_pooled(new_size, alignment) &&
+                       __size_class(std::max(new_size, alignment)) == __size_class(std::max(old_size, alignment));
+        } else {
+            expanded = __first_fit_expand(*chunk, ptr, old_size, new_size);
+        }
+        if (expanded) {
+            __record_expansion(old_size, new_size);
+        }
+        return expanded;
+    }
+
+    bool do_set_relocation_handler(void* ptr, RelocationHandler* handler, std::size_t alignment) override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_mode == AllocationMode::bitmap) {
+            return false;
+        }
+        Chunk* chunk = __chunk_of(ptr);
+        if (!chunk) {
+            throw std::logic_error("An attempt to register an unallocated block.");
+        }
+        // Pooled blocks share their slab and never move
+        if (_mode == AllocationMode::pool && __slab_of(*chunk, ptr).size_class != NO_SIZE_CLASS) {
+            return false;
+        }
+        std::size_t offset = chunk->used_blocks[__find_block(*chunk, ptr)].offset;
+        auto relocation = __find_relocation(*chunk, offset);
+        bool registered = relocation != chunk->relocations.end() && relocation->offset == offset;
+        if (!handler) {
+            if (registered) {
+                chunk->relocations.erase(relocation);
+            }
+        } else if (registered) {
+            *relocation = Relocation{offset, handler, alignment};
+        } else {
+            chunk->relocations.insert(relocation, Relocation{offset, handler, alignment});
+        }
+        return true;
+    }
+
+    // Every chunk is compacted on its own: registered blocks slide down to the end of the block
+    // before them, pinned ones stay where they are, so the free space gathers above the last
+    // pinned block. Slabs and bitmap slots are never moved.
+    std::size_t do_compact() override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_mode == AllocationMode::bitmap) {
+            return 0;
+        }
+        std::size_t moved{0};
+        for (Chunk& chunk : _chunks) {
+            if (chunk.relocations.empty()) {
+                continue;
+            }
+            // Blocks keep their order, so both tables stay sorted and are walked together
+            std::size_t free_offset{0};
+            std::size_t relocation_index{0};
+            for (std::size_t block_index = 0; block_index + 1 < chunk.used_blocks.size() &&
+                                              relocation_index < chunk.relocations.size(); ++block_index) {
+                MemoryBlock& block = chunk.used_blocks[block_index];
+                Relocation& relocation = chunk.relocations[relocation_index];
+                if (relocation.offset == block.offset) {
+                    ++relocation_index;
+                    std::uintptr_t free_address = reinterpret_cast<std::uintptr_t>(chunk.data + free_offset);
+                    std::size_t target_offset = free_offset +
+                        ((relocation.alignment - free_address % relocation.alignment) % relocation.alignment);
+                    if (target_offset < block.offset) {
+                        char* old_ptr = chunk.data + block.offset;
+                        char* new_ptr = chunk.data + target_offset;
+                        std::memmove(new_ptr, old_ptr, block.size);
+                        block.offset = target_offset;
+                        relocation.offset = target_offset;
+                        relocation.owner->relocated(old_ptr, new_ptr);
+                        ++moved;
+                    }
+                }
+                free_offset = block.offset + block.size;
+            }
+        }
+        return moved;
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+using CustomMemoryResource = BasicCustomMemoryResource<>;
+
+// Standard allocator over a BasicCustomMemoryResource that calls the resource's algorithm
+// directly instead of through memory_resource's virtual functions. Like polymorphic_allocator it
+// only points at a shared resource; unlike it, it follows the container on move assignment and
+// swap, so those never copy elements between resources.
+template<typename T, std::size_t BUFFER_SIZE = 1024>
+class CustomAllocator {
+
+    template<typename U, std::size_t OTHER_BUFFER_SIZE>
+    friend class CustomAllocator;
+
+public:
+
+    using value_type = T;
+    using resource_type = BasicCustomMemoryResource<BUFFER_SIZE>;
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+    using is_always_equal = std::false_type;
+
+    template<typename U>
+    struct rebind {
+        using other = CustomAllocator<U, BUFFER_SIZE>;
+    };
+
+private:
+
+    resource_type* _resource;
+
+public:
+
+    CustomAllocator(resource_type* resource) noexcept :
+        _resource(resource) {
+    }
+
+    template<typename U>
+    CustomAllocator(const CustomAllocator<U, BUFFER_SIZE>& other) noexcept :
+        _resource(other._resource) {
+    }
+
+    resource_type* resource() const {
+        return _resource;
+    }
+
+    T* allocate(std::size_t count) {
+        if (count > std::numeric_limits<std::size_t>::max() / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        return static_cast<T*>(_resource->allocate_direct(count * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* ptr, std::size_t count) {
+        _resource->deallocate_direct(ptr, count * sizeof(T), alignof(T));
+    }
+
+    bool try_expand(T* ptr, std::size_t old_count, std::size_t new_count) {
+        return _resource->try_expand_direct(ptr, old_count * sizeof(T), new_count * sizeof(T), alignof(T));
+    }
+
+    bool set_relocation_handler(T* ptr, RelocationHandler* handler) {
+        return _resource->set_relocation_handler(ptr, handler, alignof(T));
+    }
+
+    template<typename U>
+    bool operator==(const CustomAllocator<U, BUFFER_SIZE>& other) const noexcept {
+        return _resource == other._resource;
+    }
+};
+
+#endif
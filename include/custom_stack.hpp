@@ -1,244 +1,945 @@
-#ifndef CUSTOM_STACK_HPP
-#define CUSTOM_STACK_HPP
-
-#include <concepts>
-#include <memory_resource>
-#include <memory>
-
-template<typename StackType>
-class CustomStackIterator
-{
-private:
-    
-    const StackType* _stack_ptr;
-    std::size_t _current_index;
-
-public:
-
-    CustomStackIterator(const StackType *stack_ptr, std::size_t index):
-        _stack_ptr(stack_ptr), _current_index(index) {
-    }
-    CustomStackIterator(const CustomStackIterator& other) = default;
-    CustomStackIterator(CustomStackIterator&& other) noexcept = default;
-    CustomStackIterator& operator=(const CustomStackIterator& other) = default;
-    CustomStackIterator& operator=(CustomStackIterator&& other) noexcept = default;
-    virtual ~CustomStackIterator() noexcept = default;
-
-public:
-
-    const typename StackType::item_type& operator*() const {
-        if (_current_index >= (*_stack_ptr).size()) {
-            throw std::out_of_range("Stack iterator is out of range");
-        }
-        return (*_stack_ptr)._data_ptr.get()[_current_index];
-    }
-    
-    bool operator==(const CustomStackIterator<StackType>& other) const {
-        return (_stack_ptr == other._stack_ptr) && (_current_index == other._current_index);
-    }
-
-    bool operator!=(const CustomStackIterator<StackType>& other) const {
-        return !(*this == other);
-    }
-    
-    CustomStackIterator<StackType>& operator++() {
-        ++_current_index;
-        return *this;
-    }
-
-    CustomStackIterator<StackType> operator++(int) {
-        CustomStackIterator<StackType> tmp{*this};
-        ++_current_index;
-        return tmp;
-    }
-};
-
-
-template <typename T, typename allocator_type>
-requires std::is_default_constructible_v<T> && 
-         std::is_same_v<allocator_type, std::pmr::polymorphic_allocator<T>>
-class CustomStack 
-{
-    template<typename A>
-    friend class CustomStackIterator;
-
-private:
-
-    void free_data() {
-        if constexpr (std::is_destructible_v<T>) {
-            for (std::size_t element_index = 0; element_index < _capacity; ++element_index) {
-                std::allocator_traits<allocator_type>::destroy(
-                    _polymorphic_allocator, 
-                    _data_ptr.get() + element_index
-                );
-            }
-        }
-        if (_data_ptr) {
-            _polymorphic_allocator.deallocate(_data_ptr.get(), _capacity);
-        }
-    }
-
-    struct PolymorphicDeleter {
-        void operator()(T* ptr) const {
-            // The memory is released through the allocator
-        }
-    };
-    
-    allocator_type _polymorphic_allocator;
-    std::unique_ptr<T, PolymorphicDeleter> _data_ptr;
-    std::size_t _capacity;
-    std::size_t _size{0};
-    std::size_t INITIAL_CAPACITY{1};
-    int EXTENSION_COEF{2};
-
-public:
-
-    using item_type = T;
-
-    CustomStack(std::size_t capacity, allocator_type alloc = {}) :
-        _polymorphic_allocator(alloc),
-        _capacity(capacity),
-        _size(0)
-    {
-        T* raw_ptr = _polymorphic_allocator.allocate(capacity);
-        for (std::size_t element_index = 0; element_index < capacity; ++element_index) {
-            _polymorphic_allocator.construct(raw_ptr + element_index);
-        }
-        _data_ptr = std::unique_ptr<T, PolymorphicDeleter>(raw_ptr, PolymorphicDeleter{});
-    }
-
-    CustomStack(allocator_type alloc = {}) :
-        CustomStack::CustomStack(INITIAL_CAPACITY, alloc) {
-    }
-
-    CustomStack(const CustomStack<T, allocator_type>& other, allocator_type alloc = {}) :
-        _polymorphic_allocator(alloc),
-        _capacity(other._capacity),
-        _size(other._size)
-    {
-        T* raw_ptr = _polymorphic_allocator.allocate(other._capacity);
-        std::uninitialized_copy(other._data_ptr.get(), other._data_ptr.get() + other._capacity, raw_ptr);
-        _data_ptr = std::unique_ptr<T, PolymorphicDeleter>(raw_ptr, PolymorphicDeleter{});
-    }
-
-    CustomStack(CustomStack<T, allocator_type>&& other) noexcept :
-        _polymorphic_allocator(std::move(other._polymorphic_allocator)),
-        _capacity(other._capacity),
-        _size(other._size),
-        _data_ptr(std::move(other._data_ptr))
-    {
-        other._capacity = 0;
-        other._size = 0;
-    }
-
-    CustomStack<T, allocator_type>& operator=(const CustomStack<T, allocator_type>& other) {
-        if (this != &other) {
-            CustomStack<T, allocator_type> copy(other, other._polymorphic_allocator);
-            std::swap(_capacity, copy._capacity);
-            std::swap(_size, copy._size);
-            std::swap(_data_ptr, copy._data_ptr);
-        }
-        return *this;
-    }
-
-    CustomStack<T, allocator_type>& operator=(CustomStack<T, allocator_type>&& other) noexcept {
-        if (this != &other) {
-            free_data();
-            _capacity = other._capacity;
-            _size = other._size;
-            T* raw_ptr = _polymorphic_allocator.allocate(other._capacity);
-            std::uninitialized_move(other._data_ptr.get(), other._data_ptr.get() + other._capacity, raw_ptr);
-            _data_ptr = std::unique_ptr<T, PolymorphicDeleter>(raw_ptr, PolymorphicDeleter{});
-            other._size = 0;
-        }
-        return *this;
-    }
-
-    virtual ~CustomStack() {
-        free_data();
-    }
-
-private:
-
-    void __extend_capacity() {
-        std::size_t new_capacity{_capacity * EXTENSION_COEF};
-        T* raw_ptr = _polymorphic_allocator.allocate(new_capacity);
-        try {
-            for (std::size_t element_index = _size; element_index < new_capacity; ++element_index) {
-                _polymorphic_allocator.construct(raw_ptr + element_index);
-            }
-        } catch (...) {
-            _polymorphic_allocator.deallocate(raw_ptr, new_capacity);
-            throw;
-        }
-        std::uninitialized_move(_data_ptr.get(), _data_ptr.get() + _size, raw_ptr);
-        free_data();
-        _data_ptr = std::unique_ptr<T, PolymorphicDeleter>(raw_ptr, PolymorphicDeleter{});
-        _capacity = new_capacity;
-    }
-
-public:
-
-    std::size_t size() const {
-        return _size;
-    }
-
-    bool empty() const {
-        return _size == 0;
-    }
-
-    void push(const T& item) {
-        if (_size == _capacity) {
-            __extend_capacity();
-        }
-        _data_ptr.get()[_size] = item;
-        ++_size;
-    }
-
-    void push(T&& item) {
-        if (_size == _capacity) {
-            __extend_capacity();
-        }
-        _data_ptr.get()[_size] = std::move(item);
-        ++_size;
-    }
-
-    void pop() {
-        if (empty()) {
-            throw std::out_of_range("Stack is empty");
-        }
-        --_size;
-    }
-
-    T& top() {
-        if (empty()) {
-            throw std::out_of_range("Stack is empty");
-        }
-        return _data_ptr.get()[_size - 1];
-    }
-    
-    const T& top() const {
-        if (empty()) {
-            throw std::out_of_range("Stack is empty");
-        }
-        return _data_ptr.get()[_size - 1];
-    }
-    
-    CustomStackIterator<CustomStack<T, allocator_type>> begin() {
-        return CustomStackIterator<CustomStack<T, allocator_type>>(this, 0);
-    }
-    
-    CustomStackIterator<CustomStack<T, allocator_type>> end() {
-        return CustomStackIterator<CustomStack<T, allocator_type>>(this, _size);
-    }
-
-    CustomStackIterator<const CustomStack<T, allocator_type>> begin() const {
-        return CustomStackIterator<const CustomStack<T, allocator_type>>(this, 0);
-    }
-    
-    CustomStackIterator<const CustomStack<T, allocator_type>> end() const {
-        return CustomStackIterator<const CustomStack<T, allocator_type>>(this, _size);
-    }
-};
-
+#ifndef CUSTOM_STACK_HPP
+#define CUSTOM_STACK_HPP
+
+#include "compacting_memory_resource.hpp"
+
+#include <cassert>
+#include <concepts>
+#include <cstring>
+#include <iterator>
+#include <span>
+#include <memory_resource>
+#include <memory>
+#include <optional>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+// Contiguous iterator over the stack from bottom to top. Debug builds remember the range
+// the iterator was taken from and check every dereference; with NDEBUG it is a bare pointer.
+template<typename ItemType>
+class CustomStackIterator
+{
+public:
+
+    using iterator_concept = std::contiguous_iterator_tag;
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = std::remove_cv_t<ItemType>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = ItemType*;
+    using reference = ItemType&;
+
+private:
+
+    template<typename OtherItemType>
+    friend class CustomStackIterator;
+
+    ItemType* _current{nullptr};
+#ifndef NDEBUG
+    ItemType* _begin{nullptr};
+    ItemType* _end{nullptr};
+#endif
+
+public:
+
+    CustomStackIterator() = default;
+
+    CustomStackIterator([[maybe_unused]] ItemType* begin, ItemType* current, [[maybe_unused]] ItemType* end):
+        _current(current)
+#ifndef NDEBUG
+        , _begin(begin), _end(end)
+#endif
+    {
+    }
+
+    template<typename OtherItemType>
+    requires std::is_same_v<const OtherItemType, ItemType> && (!std::is_same_v<OtherItemType, ItemType>)
+    CustomStackIterator(const CustomStackIterator<OtherItemType>& other):
+        _current(other._current)
+#ifndef NDEBUG
+        , _begin(other._begin), _end(other._end)
+#endif
+    {
+    }
+
+    CustomStackIterator(const CustomStackIterator& other) = default;
+    CustomStackIterator(CustomStackIterator&& other) noexcept = default;
+    CustomStackIterator& operator=(const CustomStackIterator& other) = default;
+    CustomStackIterator& operator=(CustomStackIterator&& other) noexcept = default;
+    ~CustomStackIterator() noexcept = default;
+
+public:
+
+    reference operator*() const {
+#ifndef NDEBUG
+        if (_current < _begin || _current >= _end) {
+            throw std::out_of_range("Stack iterator is out of range");
+        }
+#endif
+        return *_current;
+    }
+
+    pointer operator->() const {
+        return _current;
+    }
+
+    reference operator[](difference_type offset) const {
+        return *(*this + offset);
+    }
+
+    bool operator==(const CustomStackIterator& other) const {
+        return _current == other._current;
+    }
+
+    auto operator<=>(const CustomStackIterator& other) const {
+        return _current <=> other._current;
+    }
+
+    CustomStackIterator& operator++() {
+        ++_current;
+        return *this;
+    }
+
+    CustomStackIterator operator++(int) {
+        CustomStackIterator tmp{*this};
+        ++_current;
+        return tmp;
+    }
+
+    CustomStackIterator& operator--() {
+        --_current;
+        return *this;
+    }
+
+    CustomStackIterator operator--(int) {
+        CustomStackIterator tmp{*this};
+        --_current;
+        return tmp;
+    }
+
+    CustomStackIterator& operator+=(difference_type offset) {
+        _current += offset;
+        return *this;
+    }
+
+    CustomStackIterator& operator-=(difference_type offset) {
+        _current -= offset;
+        return *this;
+    }
+
+    CustomStackIterator operator+(difference_type offset) const {
+        CustomStackIterator tmp{*this};
+        return tmp += offset;
+    }
+
+    friend CustomStackIterator operator+(difference_type offset, const CustomStackIterator& iterator) {
+        return iterator + offset;
+    }
+
+    CustomStackIterator operator-(difference_type offset) const {
+        CustomStackIterator tmp{*this};
+        return tmp -= offset;
+    }
+
+    difference_type operator-(const CustomStackIterator& other) const {
+        return _current - other._current;
+    }
+};
+
+// Raw room for INLINE_CAPACITY elements inside the stack object; empty when there is none
+template<typename T, std::size_t INLINE_CAPACITY>
+struct CustomStackInlineStorage {
+    alignas(T) unsigned char bytes[INLINE_CAPACITY * sizeof(T)];
+
+    T* data() {
+        return reinterpret_cast<T*>(bytes);
+    }
+
+    const T* data() const {
+        return reinterpret_cast<const T*>(bytes);
+    }
+};
+
+template<typename T>
+struct CustomStackInlineStorage<T, 0> {
+    T* data() {
+        return nullptr;
+    }
+
+    const T* data() const {
+        return nullptr;
+    }
+};
+
+// Growth policies pick the capacity a full stack reallocates to (at least required elements) and,
+// through shrink_capacity, whether a pop hands memory back; returning the capacity keeps it.
+template<std::size_t NUMERATOR = 2, std::size_t DENOMINATOR = 1>
+requires (NUMERATOR > DENOMINATOR && DENOMINATOR > 0)
+struct GeometricGrowth {
+    static std::size_t next_capacity(std::size_t capacity, std::size_t required, std::size_t /* item_size */) noexcept {
+        return std::max({required, capacity + 1, capacity / DENOMINATOR * NUMERATOR + capacity % DENOMINATOR * NUMERATOR / DENOMINATOR});
+    }
+
+    static std::size_t shrink_capacity(std::size_t /* size */, std::size_t capacity) {
+        return capacity;
+    }
+};
+
+template<std::size_t INCREMENT>
+requires (INCREMENT > 0)
+struct FixedIncrementGrowth {
+    static std::size_t next_capacity(std::size_t capacity, std::size_t required, std::size_t /* item_size */) noexcept {
+        return std::max(required, capacity + INCREMENT);
+    }
+
+    static std::size_t shrink_capacity(std::size_t /* size */, std::size_t capacity) {
+        return capacity;
+    }
+};
+
+// Fills the storage up to the next multiple of BOUNDARY bytes, e.g. a cache line or a page
+template<std::size_t BOUNDARY, typename Growth = GeometricGrowth<>>
+struct RoundedGrowth: Growth {
+    static std::size_t next_capacity(std::size_t capacity, std::size_t required, std::size_t item_size)
+        noexcept(noexcept(Growth::next_capacity(capacity, required, item_size))) {
+        std::size_t bytes = Growth::next_capacity(capacity, required, item_size) * item_size;
+        return (bytes + BOUNDARY - 1) / BOUNDARY * BOUNDARY / item_size;
+    }
+};
+
+using CacheLineGrowth = RoundedGrowth<64>;
+using PageGrowth = RoundedGrowth<4096>;
+
+// Halves the storage once the stack drops below 1/SHRINK_DIVISOR of its capacity; the gap between
+// the two thresholds keeps pushes and pops around one size from reallocating every time
+template<typename Growth = GeometricGrowth<>, std::size_t SHRINK_DIVISOR = 4>
+requires (SHRINK_DIVISOR > 2)
+struct HysteresisShrink: Growth {
+    static std::size_t shrink_capacity(std::size_t size, std::size_t capacity) {
+        if (size * SHRINK_DIVISOR >= capacity) {
+            return capacity;
+        }
+        return std::max<std::size_t>(capacity / 2, 1);
+    }
+};
+
+// Works with any allocator of T whose pointer is T*. Allocators with a
+// try_expand(ptr, old_count, new_count) member, or a polymorphic_allocator over an
+// ExpandableMemoryResource, let the storage grow in place. After enable_relocation(), storage of
+// trivially copyable elements is registered with a CompactingMemoryResource (or an allocator with
+// set_relocation_handler), so compact() may move it.
+// With INLINE_CAPACITY > 0 the first elements live inside the object and the allocator is only
+// asked for storage once the stack outgrows them
+template <typename T, typename allocator_type, std::size_t INLINE_CAPACITY = 0,
+          typename growth_policy = GeometricGrowth<>>
+requires std::is_same_v<typename std::allocator_traits<allocator_type>::value_type, T>
+      && std::is_same_v<typename std::allocator_traits<allocator_type>::pointer, T*>
+class CustomStack
+{
+    using allocator_traits = std::allocator_traits<allocator_type>;
+
+private:
+
+    void destroy_elements() {
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            for (std::size_t element_index = 0; element_index < _size; ++element_index) {
+                allocator_traits::destroy(_allocator, _data_ptr.get() + element_index);
+            }
+        }
+    }
+
+    void free_data() {
+        destroy_elements();
+        if (_data_ptr && !__is_inline()) {
+            allocator_traits::deallocate(_allocator, _data_ptr.get(), _capacity);
+        }
+    }
+
+    struct StorageDeleter {
+        void operator()(T* /* ptr */) const {
+            // The memory is released through the allocator
+        }
+    };
+
+    // Registered with the resource instead of the stack itself, so moving the stack only has to
+    // repoint the owner and never touches the resource
+    struct Relocator: RelocationHandler {
+        explicit Relocator(CustomStack* owner) : owner(owner) {}
+
+        void relocated(void* /* old_ptr */, void* new_ptr) noexcept override {
+            owner->_data_ptr.reset(static_cast<T*>(new_ptr));
+        }
+
+        CustomStack* owner;
+    };
+    
+    allocator_type _allocator;
+    [[no_unique_address]] CustomStackInlineStorage<T, INLINE_CAPACITY> _inline_storage;
+    std::unique_ptr<T, StorageDeleter> _data_ptr;
+    std::size_t _capacity;
+    std::size_t _size{0};
+    std::unique_ptr<Relocator> _relocator;
+    static constexpr std::size_t INITIAL_CAPACITY{1};
+
+    // try_emplace can only promise not to throw over std::allocator, which reports every failure
+    // as std::bad_alloc; a resource behind any other allocator may throw e.g. on a failed lock
+    template<typename... Args>
+    static constexpr bool NOTHROW_TRY_EMPLACE{
+        std::is_same_v<allocator_type, std::allocator<T>> && std::is_nothrow_constructible_v<T, Args...> &&
+        std::is_nothrow_move_constructible_v<T> && std::is_nothrow_destructible_v<T> &&
+        noexcept(growth_policy::next_capacity(std::size_t{}, std::size_t{}, std::size_t{}))};
+
+public:
+
+    using item_type = T;
+    using value_type = T;
+    using iterator = CustomStackIterator<T>;
+    using const_iterator = CustomStackIterator<const T>;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    // Storage given up by release(): the first size of capacity slots hold live elements
+    struct Storage {
+        T* data{nullptr};
+        std::size_t size{0};
+        std::size_t capacity{0};
+    };
+
+    // Only reserves raw storage, elements are constructed by push/emplace
+    CustomStack(std::size_t capacity, allocator_type alloc = {}) :
+        _allocator(alloc),
+        _capacity(capacity),
+        _size(0)
+    {
+        if (INLINE_CAPACITY != 0 && capacity <= INLINE_CAPACITY) {
+            __use_inline_storage();
+        } else {
+            _data_ptr = std::unique_ptr<T, StorageDeleter>(allocator_traits::allocate(_allocator, capacity), StorageDeleter{});
+        }
+    }
+
+    CustomStack(allocator_type alloc = {}) :
+        CustomStack::CustomStack(INITIAL_CAPACITY, alloc) {
+    }
+
+    // Takes over storage allocated through alloc, e.g. one released by another stack
+    CustomStack(Storage storage, allocator_type alloc) :
+        _allocator(alloc),
+        _data_ptr(storage.data, StorageDeleter{}),
+        _capacity(storage.capacity),
+        _size(storage.size)
+    {
+    }
+
+    CustomStack(const CustomStack& other) :
+        CustomStack::CustomStack(other, allocator_traits::select_on_container_copy_construction(other._allocator)) {
+    }
+
+    CustomStack(const CustomStack& other, allocator_type alloc) :
+        CustomStack::CustomStack(other._size, alloc)
+    {
+        std::uninitialized_copy(other._data_ptr.get(), other._data_ptr.get() + other._size, _data_ptr.get());
+        _size = other._size;
+    }
+
+    // Inline elements cannot be stolen and are moved one by one; relocation stays enabled for the
+    // new stack and ends for the moved-from one
+    CustomStack(CustomStack&& other) noexcept(INLINE_CAPACITY == 0 || std::is_nothrow_move_constructible_v<T>) :
+        _allocator(other._allocator),
+        _capacity(other._capacity),
+        _size(0)
+    {
+        __take_relocator(other);
+        if (other.__is_inline()) {
+            __use_inline_storage();
+            other.__move_elements_to(_data_ptr.get());
+            _size = other._size;
+            other.destroy_elements();
+        } else {
+            _data_ptr = std::move(other._data_ptr);
+            _size = other._size;
+            other.__release_storage();
+        }
+        other._size = 0;
+    }
+
+    // Only the live elements are copied; the allocator is replaced only when it propagates on
+    // copy assignment, and storage from the old one is freed first
+    CustomStack& operator=(const CustomStack& other) {
+        if (this != &other) {
+            if constexpr (allocator_traits::propagate_on_container_copy_assignment::value) {
+                if (_allocator != other._allocator) {
+                    free_data();
+                    _size = 0;
+                    __release_storage();
+                }
+                _allocator = other._allocator;
+            }
+            if (_capacity < other._size) {
+                T* raw_ptr = __allocate_storage(other._size);
+                try {
+                    std::uninitialized_copy(other._data_ptr.get(), other._data_ptr.get() + other._size, raw_ptr);
+                } catch (...) {
+                    allocator_traits::deallocate(_allocator, raw_ptr, other._size);
+                    throw;
+                }
+                __adopt_storage(raw_ptr, other._size);
+                _size = other._size;
+            } else {
+                destroy_elements();
+                _size = 0;
+                std::uninitialized_copy(other._data_ptr.get(), other._data_ptr.get() + other._size, _data_ptr.get());
+                _size = other._size;
+            }
+        }
+        return *this;
+    }
+
+    // Steals the storage when the allocators are equal or the allocator propagates on move,
+    // otherwise the elements are moved into storage from this stack's allocator. Stolen storage
+    // keeps the relocation setting of the stack it came from
+    CustomStack& operator=(CustomStack&& other) {
+        constexpr bool propagate = allocator_traits::propagate_on_container_move_assignment::value;
+        if (this == &other) {
+            return *this;
+        }
+        if ((propagate || _allocator == other._allocator) && !other.__is_inline()) {
+            free_data();
+            if constexpr (propagate) {
+                _allocator = other._allocator;
+            }
+            _data_ptr = std::move(other._data_ptr);
+            _capacity = other._capacity;
+            _size = other._size;
+            other.__release_storage();
+            other._size = 0;
+            __take_relocator(other);
+            return *this;
+        }
+        destroy_elements();
+        _size = 0;
+        if constexpr (propagate) {
+            if (_allocator != other._allocator) {
+                free_data();
+                __release_storage();
+                _allocator = other._allocator;
+            }
+        }
+        reserve(other._size);
+        other.__move_elements_to(_data_ptr.get());
+        _size = other._size;
+        other.destroy_elements();
+        other._size = 0;
+        return *this;
+    }
+
+    virtual ~CustomStack() {
+        free_data();
+    }
+
+    // Exchanges the storage when the allocators allow it; otherwise, or when either stack is
+    // inline, the elements are moved and every stack keeps its allocator
+    void swap(CustomStack& other) {
+        constexpr bool propagate = allocator_traits::propagate_on_container_swap::value;
+        if (this == &other) {
+            return;
+        }
+        if ((propagate || _allocator == other._allocator) && !__is_inline() && !other.__is_inline()) {
+            if constexpr (propagate) {
+                using std::swap;
+                swap(_allocator, other._allocator);
+            }
+            std::swap(_data_ptr, other._data_ptr);
+            std::swap(_capacity, other._capacity);
+            std::swap(_size, other._size);
+            std::swap(_relocator, other._relocator);
+            __repoint_relocator();
+            other.__repoint_relocator();
+            return;
+        }
+        CustomStack moved(std::move(other));
+        other = std::move(*this);
+        *this = std::move(moved);
+    }
+
+    friend void swap(CustomStack& left, CustomStack& right) {
+        left.swap(right);
+    }
+
+private:
+
+    bool __is_inline() const {
+        if constexpr (INLINE_CAPACITY == 0) {
+            return false;
+        } else {
+            return _data_ptr.get() == _inline_storage.data();
+        }
+    }
+
+    void __use_inline_storage() {
+        _data_ptr = std::unique_ptr<T, StorageDeleter>(_inline_storage.data(), StorageDeleter{});
+        _capacity = INLINE_CAPACITY;
+    }
+
+    // Leaves the stack with no storage of its own after another stack has taken it over
+    void __release_storage() {
+        _data_ptr.release();
+        if constexpr (INLINE_CAPACITY != 0) {
+            __use_inline_storage();
+        } else {
+            _capacity = 0;
+        }
+    }
+
+    // Registers a new block before anything is put there, so a failed registration only has to
+    // free it and leaves the stack as it was
+    T* __allocate_storage(std::size_t capacity) {
+        T* raw_ptr = allocator_traits::allocate(_allocator, capacity);
+        if (_relocator) {
+            try {
+                __track_storage(raw_ptr, _relocator.get());
+            } catch (...) {
+                allocator_traits::deallocate(_allocator, raw_ptr, capacity);
+                throw;
+            }
+        }
+        return raw_ptr;
+    }
+
+    // Frees the current storage and switches to raw_ptr, which already holds the moved elements
+    void __adopt_storage(T* raw_ptr, std::size_t capacity) {
+        free_data();
+        _data_ptr = std::unique_ptr<T, StorageDeleter>(raw_ptr, StorageDeleter{});
+        _capacity = capacity;
+    }
+
+    // Points the resource at the handler of the allocated block ptr; elements are moved bytewise,
+    // so storage of other types stays pinned
+    void __track_storage([[maybe_unused]] T* ptr, [[maybe_unused]] RelocationHandler* handler) {
+        if constexpr (std::is_trivially_copyable_v<T>) {
+            if (!ptr || ptr == _inline_storage.data()) {
+                return;
+            }
+            if constexpr (requires(allocator_type& allocator) {
+                              allocator.set_relocation_handler(ptr, handler);
+                          }) {
+                _allocator.set_relocation_handler(ptr, handler);
+            } else if constexpr (std::is_same_v<allocator_type, std::pmr::polymorphic_allocator<T>>) {
+                if (auto* compacting = dynamic_cast<CompactingMemoryResource*>(_allocator.resource())) {
+                    compacting->set_relocation_handler(ptr, handler, alignof(T));
+                }
+            }
+        }
+    }
+
+    // The storage taken from other is registered with other's relocator, so it comes along
+    void __take_relocator(CustomStack& other) noexcept {
+        _relocator = std::move(other._relocator);
+        __repoint_relocator();
+    }
+
+    void __repoint_relocator() noexcept {
+        if (_relocator) {
+            _relocator->owner = this;
+        }
+    }
+
+    bool __try_expand_in_place(std::size_t new_capacity) {
+        if (!_data_ptr || __is_inline()) {
+            return false;
+        }
+        bool expanded{false};
+        if constexpr (requires(allocator_type& allocator, T* ptr, std::size_t count) {
+                          { allocator.try_expand(ptr, count, count) } -> std::convertible_to<bool>;
+                      }) {
+            expanded = _allocator.try_expand(_data_ptr.get(), _capacity, new_capacity);
+        } else if constexpr (std::is_same_v<allocator_type, std::pmr::polymorphic_allocator<T>>) {
+            auto* expandable = dynamic_cast<ExpandableMemoryResource*>(_allocator.resource());
+            expanded = expandable &&
+                expandable->try_expand(_data_ptr.get(), _capacity * sizeof(T), new_capacity * sizeof(T), alignof(T));
+        }
+        if (!expanded) {
+            return false;
+        }
+        _capacity = new_capacity;
+        return true;
+    }
+
+    void __move_elements_to(T* raw_ptr) {
+        if constexpr (std::is_trivially_copyable_v<T>) {
+            if (_size != 0) {
+                std::memcpy(static_cast<void*>(raw_ptr), _data_ptr.get(), _size * sizeof(T));
+            }
+        } else {
+            std::uninitialized_move(_data_ptr.get(), _data_ptr.get() + _size, raw_ptr);
+        }
+    }
+
+    // Shrinking always moves to a new block: a resource may accept a smaller size in place
+    // without giving anything back
+    void __reallocate(std::size_t new_capacity) {
+        if (new_capacity > _capacity && __try_expand_in_place(new_capacity)) {
+            return;
+        }
+        T* raw_ptr = __allocate_storage(new_capacity);
+        try {
+            __move_elements_to(raw_ptr);
+        } catch (...) {
+            allocator_traits::deallocate(_allocator, raw_ptr, new_capacity);
+            throw;
+        }
+        __adopt_storage(raw_ptr, new_capacity);
+    }
+
+    // Makes room for count more elements, keeping the growth policy of single pushes
+    void __reserve_more(std::size_t count) {
+        if (_capacity - _size < count) {
+            __reallocate(growth_policy::next_capacity(_capacity, _size + count, sizeof(T)));
+        }
+    }
+
+    // Moves the elements into smaller storage, back inline when they fit there
+    void __shrink_to(std::size_t new_capacity) {
+        if (INLINE_CAPACITY != 0 && new_capacity <= INLINE_CAPACITY) {
+            T* inline_ptr = _inline_storage.data();
+            __move_elements_to(inline_ptr);
+            __adopt_storage(inline_ptr, INLINE_CAPACITY);
+            return;
+        }
+        __reallocate(new_capacity);
+    }
+
+    // Asks the policy after every pop; memory is only returned on a best-effort basis, so a
+    // failed reallocation leaves the stack as it was and the pop still succeeds
+    void __maybe_shrink() {
+        if (__is_inline() || !_data_ptr) {
+            return;
+        }
+        std::size_t new_capacity{_capacity};
+        for (std::size_t next = growth_policy::shrink_capacity(_size, new_capacity); next < new_capacity;
+             next = growth_policy::shrink_capacity(_size, new_capacity)) {
+            new_capacity = next;
+        }
+        if (new_capacity < _capacity) {
+            try {
+                __shrink_to(std::max(new_capacity, _size));
+            } catch (const std::bad_alloc&) {
+            }
+        }
+    }
+
+    // Storage with room for one more element: the current one when it grows in place, otherwise
+    // a new block for __fill_extension
+    T* __allocate_extension(std::size_t new_capacity) {
+        if (__try_expand_in_place(new_capacity)) {
+            return _data_ptr.get();
+        }
+        return __allocate_storage(new_capacity);
+    }
+
+    // Builds the pushed element in the new storage before the old elements are moved out,
+    // so arguments that refer to elements of this stack stay valid
+    template<typename... Args>
+    void __fill_extension(T* raw_ptr, std::size_t new_capacity, Args&&... args) {
+        if (raw_ptr == _data_ptr.get()) {
+            allocator_traits::construct(_allocator, raw_ptr + _size, std::forward<Args>(args)...);
+            return;
+        }
+        try {
+            allocator_traits::construct(_allocator, raw_ptr + _size, std::forward<Args>(args)...);
+        } catch (...) {
+            allocator_traits::deallocate(_allocator, raw_ptr, new_capacity);
+            throw;
+        }
+        try {
+            __move_elements_to(raw_ptr);
+        } catch (...) {
+            allocator_traits::destroy(_allocator, raw_ptr + _size);
+            allocator_traits::deallocate(_allocator, raw_ptr, new_capacity);
+            throw;
+        }
+        __adopt_storage(raw_ptr, new_capacity);
+    }
+
+    template<typename... Args>
+    void __extend_capacity(Args&&... args) {
+        std::size_t new_capacity{growth_policy::next_capacity(_capacity, _size + 1, sizeof(T))};
+        __fill_extension(__allocate_extension(new_capacity), new_capacity, std::forward<Args>(args)...);
+    }
+
+public:
+
+    allocator_type get_allocator() const {
+        return _allocator;
+    }
+
+    // Lets compact() on the resource move the storage, now and after every reallocation. It is
+    // opt-in because every registration goes through the resource's lock
+    void enable_relocation() requires std::is_trivially_copyable_v<T> {
+        if (_relocator) {
+            return;
+        }
+        auto relocator = std::make_unique<Relocator>(this);
+        __track_storage(_data_ptr.get(), relocator.get());
+        _relocator = std::move(relocator);
+    }
+
+    // Gives up the storage without destroying or freeing anything and leaves the stack empty;
+    // inline elements are moved to allocated storage first
+    Storage release() {
+        if (__is_inline()) {
+            __reallocate(std::max<std::size_t>(_size, 1));
+        }
+        Storage storage{_data_ptr.get(), _size, _capacity};
+        if (_relocator) {
+            __track_storage(_data_ptr.get(), nullptr);
+        }
+        __release_storage();
+        _size = 0;
+        return storage;
+    }
+
+    std::size_t size() const noexcept {
+        return _size;
+    }
+
+    bool empty() const noexcept {
+        return _size == 0;
+    }
+
+    template<typename... Args>
+    T& emplace(Args&&... args) {
+        if (_size == _capacity) {
+            __extend_capacity(std::forward<Args>(args)...);
+        } else {
+            allocator_traits::construct(_allocator, _data_ptr.get() + _size, std::forward<Args>(args)...);
+        }
+        ++_size;
+        return _data_ptr.get()[_size - 1];
+    }
+
+    void push(const T& item) {
+        emplace(item);
+    }
+
+    void push(T&& item) {
+        emplace(std::move(item));
+    }
+
+    void pop() {
+        if (empty()) {
+            throw std::out_of_range("Stack is empty");
+        }
+        unchecked_pop();
+        __maybe_shrink();
+    }
+
+    // Like emplace, but a failed allocation returns nullptr and leaves the stack unchanged. Only
+    // std::bad_alloc from the allocation is caught: T's constructors and a resource that throws
+    // anything else (e.g. on a foreign pointer or a failed lock) still propagate
+    template<typename... Args>
+    T* try_emplace(Args&&... args) noexcept(NOTHROW_TRY_EMPLACE<Args...>) {
+        if (_size == _capacity) [[unlikely]] {
+            std::size_t new_capacity{growth_policy::next_capacity(_capacity, _size + 1, sizeof(T))};
+            T* raw_ptr{nullptr};
+            try {
+                raw_ptr = __allocate_extension(new_capacity);
+            } catch (const std::bad_alloc&) {
+                return nullptr;
+            }
+            __fill_extension(raw_ptr, new_capacity, std::forward<Args>(args)...);
+        } else {
+            allocator_traits::construct(_allocator, _data_ptr.get() + _size, std::forward<Args>(args)...);
+        }
+        ++_size;
+        return _data_ptr.get() + _size - 1;
+    }
+
+    bool try_push(const T& item) noexcept(NOTHROW_TRY_EMPLACE<const T&>) {
+        return try_emplace(item) != nullptr;
+    }
+
+    bool try_push(T&& item) noexcept(NOTHROW_TRY_EMPLACE<T&&>) {
+        return try_emplace(std::move(item)) != nullptr;
+    }
+
+    // Moves the top element out, or returns nothing when the stack is empty. Like unchecked_pop,
+    // it never asks the growth policy to shrink
+    std::optional<T> try_pop() noexcept(std::is_nothrow_move_constructible_v<T>) {
+        if (empty()) {
+            return std::nullopt;
+        }
+        std::optional<T> item(std::move(_data_ptr.get()[_size - 1]));
+        unchecked_pop();
+        return item;
+    }
+
+    // The stack must not be empty; only debug builds check it. The capacity is kept even with a
+    // shrinking growth policy, pop() and shrink_to_fit() hand memory back
+    void unchecked_pop() noexcept(std::is_nothrow_destructible_v<T>) {
+        assert(!empty() && "unchecked_pop on an empty stack");
+        --_size;
+        allocator_traits::destroy(_allocator, _data_ptr.get() + _size);
+    }
+
+    std::size_t capacity() const noexcept {
+        return _capacity;
+    }
+
+    // Gives the unused tail of the storage back to the resource; elements that fit inline move
+    // back into the object
+    void shrink_to_fit() {
+        if (_size == _capacity || __is_inline()) {
+            return;
+        }
+        if (_size == 0 && INLINE_CAPACITY == 0) {
+            free_data();
+            _data_ptr.reset();
+            _capacity = 0;
+            return;
+        }
+        __shrink_to(_size);
+    }
+
+    void reserve(std::size_t capacity) {
+        if (capacity > _capacity) {
+            __reallocate(capacity);
+        }
+    }
+
+    // Pushes the range bottom to top with one reservation; the range must not refer into this stack
+    template<std::input_iterator Iterator, std::sentinel_for<Iterator> Sentinel>
+    void push_range(Iterator first, Sentinel last) {
+        if constexpr (std::forward_iterator<Iterator>) {
+            std::size_t count = static_cast<std::size_t>(std::ranges::distance(first, last));
+            __reserve_more(count);
+            T* destination = _data_ptr.get() + _size;
+            if constexpr (std::contiguous_iterator<Iterator> && std::is_trivially_copyable_v<T> &&
+                          std::is_same_v<std::remove_cvref_t<std::iter_reference_t<Iterator>>, T>) {
+                if (count != 0) {
+                    std::memcpy(static_cast<void*>(destination), std::to_address(first), count * sizeof(T));
+                }
+            } else {
+                std::size_t constructed{0};
+                try {
+                    for (; constructed < count; ++constructed, ++first) {
+                        allocator_traits::construct(_allocator, destination + constructed, *first);
+                    }
+                } catch (...) {
+                    for (std::size_t element_index = 0; element_index < constructed; ++element_index) {
+                        allocator_traits::destroy(_allocator, destination + element_index);
+                    }
+                    throw;
+                }
+            }
+            _size += count;
+        } else {
+            for (; first != last; ++first) {
+                emplace(*first);
+            }
+        }
+    }
+
+    void push_range(std::span<const T> items) {
+        push_range(items.begin(), items.end());
+    }
+
+    void pop_n(std::size_t count) {
+        if (count > _size) {
+            throw std::out_of_range("Stack has fewer elements than requested");
+        }
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            for (std::size_t element_index = _size - count; element_index < _size; ++element_index) {
+                allocator_traits::destroy(_allocator, _data_ptr.get() + element_index);
+            }
+        }
+        _size -= count;
+        __maybe_shrink();
+    }
+
+    T& top() {
+        if (empty()) {
+            throw std::out_of_range("Stack is empty");
+        }
+        return _data_ptr.get()[_size - 1];
+    }
+    
+    const T& top() const {
+        if (empty()) {
+            throw std::out_of_range("Stack is empty");
+        }
+        return _data_ptr.get()[_size - 1];
+    }
+
+    // The stack must not be empty; only debug builds check it
+    T& unchecked_top() noexcept {
+        assert(!empty() && "unchecked_top on an empty stack");
+        return _data_ptr.get()[_size - 1];
+    }
+
+    const T& unchecked_top() const noexcept {
+        assert(!empty() && "unchecked_top on an empty stack");
+        return _data_ptr.get()[_size - 1];
+    }
+    
+    T* data() {
+        return _data_ptr.get();
+    }
+
+    const T* data() const {
+        return _data_ptr.get();
+    }
+
+    // Elements from bottom to top
+    std::span<T> as_span() {
+        return {_data_ptr.get(), _size};
+    }
+
+    std::span<const T> as_span() const {
+        return {_data_ptr.get(), _size};
+    }
+
+    iterator begin() {
+        return iterator(data(), data(), data() + _size);
+    }
+    
+    iterator end() {
+        return iterator(data(), data() + _size, data() + _size);
+    }
+
+    const_iterator begin() const {
+        return const_iterator(data(), data(), data() + _size);
+    }
+    
+    const_iterator end() const {
+        return const_iterator(data(), data() + _size, data() + _size);
+    }
+
+    const_iterator cbegin() const {
+        return begin();
+    }
+
+    const_iterator cend() const {
+        return end();
+    }
+
+    // Reverse iteration walks from the top of the stack down to the bottom
+    reverse_iterator rbegin() {
+        return reverse_iterator(end());
+    }
+
+    reverse_iterator rend() {
+        return reverse_iterator(begin());
+    }
+
+    const_reverse_iterator rbegin() const {
+        return const_reverse_iterator(end());
+    }
+
+    const_reverse_iterator rend() const {
+        return const_reverse_iterator(begin());
+    }
+};
+
 #endif
\ No newline at end of file
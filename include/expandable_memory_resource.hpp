@@ -0,0 +1,24 @@
+#ifndef EXPANDABLE_MEMORY_RESOURCE_HPP
+#define EXPANDABLE_MEMORY_RESOURCE_HPP
+
+#include <memory_resource>
+
+// A memory_resource that can sometimes grow an allocated block where it lies. Containers check
+// for it with dynamic_cast and fall back to allocate + move + deallocate when it is missing or
+// when try_expand returns false.
+class ExpandableMemoryResource: public std::pmr::memory_resource {
+
+public:
+
+    // On success the block must later be deallocated with new_size
+    bool try_expand(void* ptr, std::size_t old_size, std::size_t new_size,
+                    std::size_t alignment = alignof(std::max_align_t)) {
+        return do_try_expand(ptr, old_size, new_size, alignment);
+    }
+
+private:
+
+    virtual bool do_try_expand(void* ptr, std::size_t old_size, std::size_t new_size, std::size_t alignment) = 0;
+};
+
+#endif
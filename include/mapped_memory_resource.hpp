@@ -0,0 +1,340 @@
+#ifndef MAPPED_MEMORY_RESOURCE_HPP
+#define MAPPED_MEMORY_RESOURCE_HPP
+
+#include "expandable_memory_resource.hpp"
+#include "custom_stack.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory_resource>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Persistent slot in the file header describing one array kept across runs
+struct MappedRoot {
+    std::uint64_t offset{0};
+    std::uint64_t size{0};
+    std::uint64_t capacity{0};
+    std::uint64_t item_size{0};
+};
+
+// First-fit allocator whose arena is a shared mapping of a file. The table of used blocks lives
+// in the mapping too and records offsets rather than pointers, so reopening the file at another
+// address restores the allocator state as it was. Changes reach the file whenever the kernel
+// writes the pages back; flush() forces that and waits for it.
+class MappedMemoryResource: public ExpandableMemoryResource {
+
+    struct MemoryBlock {
+        std::uint64_t offset;
+        std::uint64_t size;
+    };
+
+    struct FileHeader {
+        char magic[8];
+        std::uint64_t file_size;
+        std::uint64_t block_capacity;
+        std::uint64_t block_count;
+        std::uint64_t data_offset;
+        MappedRoot root;
+    };
+
+private:
+
+    static constexpr char MAGIC[8] = {'C', 'M', 'R', 'M', 'A', 'P', '0', '1'};
+    static constexpr std::size_t DATA_ALIGNMENT{64};
+
+    int _file_descriptor{-1};
+    char* _mapping{nullptr};
+    std::size_t _file_size{0};
+    std::mutex _mutex;
+    // Set while a stack loaded from the root slot uses its storage. It is not kept in the file, so
+    // after a crash or a restart the saved storage is nobody's again.
+    bool _root_attached{false};
+
+public:
+
+    // Opens the file, creating and formatting it with file_size bytes and room for max_blocks
+    // allocations when it is empty; an existing file keeps its own size and table
+    explicit MappedMemoryResource(const std::string& path, std::size_t file_size = 1 << 20,
+                                  std::size_t max_blocks = 1024)
+    {
+        _file_descriptor = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (_file_descriptor < 0) {
+            throw std::system_error(errno, std::generic_category(), "Cannot open " + path);
+        }
+        try {
+            struct stat file_status{};
+            if (::fstat(_file_descriptor, &file_status) != 0) {
+                throw std::system_error(errno, std::generic_category(), "Cannot stat " + path);
+            }
+            bool created = file_status.st_size == 0;
+            if (created) {
+                if (__data_offset(max_blocks) >= file_size) {
+                    throw std::invalid_argument("The file is too small for its block table.");
+                }
+                if (::ftruncate(_file_descriptor, static_cast<off_t>(file_size)) != 0) {
+                    throw std::system_error(errno, std::generic_category(), "Cannot resize " + path);
+                }
+            } else {
+                file_size = static_cast<std::size_t>(file_status.st_size);
+            }
+            if (file_size < sizeof(FileHeader)) {
+                throw std::runtime_error("Not a mapped memory resource file: " + path);
+            }
+            void* mapping = ::mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, _file_descriptor, 0);
+            if (mapping == MAP_FAILED) {
+                throw std::system_error(errno, std::generic_category(), "Cannot map " + path);
+            }
+            _mapping = static_cast<char*>(mapping);
+            _file_size = file_size;
+            if (created) {
+                __format(max_blocks);
+            } else if (std::memcmp(__header().magic, MAGIC, sizeof(MAGIC)) != 0 ||
+                       __header().file_size != _file_size) {
+                throw std::runtime_error("Not a mapped memory resource file: " + path);
+            }
+        } catch (...) {
+            __close();
+            throw;
+        }
+    }
+
+    MappedMemoryResource(const MappedMemoryResource&) = delete;
+    MappedMemoryResource& operator=(const MappedMemoryResource&) = delete;
+
+    ~MappedMemoryResource() override {
+        __close();
+    }
+
+public:
+
+    // Writes every modified page to the file and waits for the write to finish
+    void flush() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (::msync(_mapping, _file_size, MS_SYNC) != 0) {
+            throw std::system_error(errno, std::generic_category(), "Cannot flush the mapping");
+        }
+    }
+
+    std::size_t file_size() const {
+        return _file_size;
+    }
+
+    // Allocated blocks, kept across reopening
+    std::size_t block_count() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return __header().block_count - 1;
+    }
+
+    // Describes the array as it was saved. When the loaded stack frees the array, on destruction or
+    // when it moves to other storage, the block stays allocated for the slot; growing it in place
+    // updates the capacity. Only save_stack frees a saved array.
+    MappedRoot& root() {
+        return __header().root;
+    }
+
+    bool root_attached() const {
+        return _root_attached;
+    }
+
+    void set_root_attached(bool attached) {
+        _root_attached = attached;
+    }
+
+    bool contains(const void* ptr) const {
+        return ptr >= _mapping && ptr < _mapping + _file_size;
+    }
+
+    std::uint64_t offset_of(const void* ptr) const {
+        return static_cast<std::uint64_t>(static_cast<const char*>(ptr) - _mapping);
+    }
+
+    void* address_of(std::uint64_t offset) const {
+        return _mapping + offset;
+    }
+
+private:
+
+    static constexpr std::size_t __align_up(std::size_t value, std::size_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    // The header is followed by the block table; the last table entry is a sentinel {end, 0}
+    static constexpr std::size_t __data_offset(std::size_t max_blocks) {
+        return __align_up(sizeof(FileHeader) + (max_blocks + 1) * sizeof(MemoryBlock), DATA_ALIGNMENT);
+    }
+
+    FileHeader& __header() const {
+        return *reinterpret_cast<FileHeader*>(_mapping);
+    }
+
+    MemoryBlock* __blocks() const {
+        return reinterpret_cast<MemoryBlock*>(_mapping + sizeof(FileHeader));
+    }
+
+    void __format(std::size_t max_blocks) {
+        FileHeader& header = __header();
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.file_size = _file_size;
+        header.block_capacity = max_blocks + 1;
+        header.block_count = 1;
+        header.data_offset = __data_offset(max_blocks);
+        header.root = MappedRoot{};
+        __blocks()[0] = MemoryBlock{_file_size, 0};
+    }
+
+    void __close() {
+        if (_mapping) {
+            ::munmap(_mapping, _file_size);
+            _mapping = nullptr;
+        }
+        if (_file_descriptor >= 0) {
+            ::close(_file_descriptor);
+            _file_descriptor = -1;
+        }
+    }
+
+    std::size_t __find_block(const void* ptr) const {
+        if (!contains(ptr)) {
+            throw std::logic_error("An attempt to free an unallocated block.");
+        }
+        MemoryBlock* blocks = __blocks();
+        std::uint64_t offset = offset_of(ptr);
+        MemoryBlock* last = blocks + __header().block_count - 1;
+        MemoryBlock* found = std::lower_bound(blocks, last, offset, [](const MemoryBlock& block, std::uint64_t value) {
+            return block.offset < value;
+        });
+        if (found == last || found->offset != offset) {
+            throw std::logic_error("An attempt to free an unallocated block.");
+        }
+        return static_cast<std::size_t>(found - blocks);
+    }
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        bytes = std::max<std::size_t>(bytes, 1);
+        FileHeader& header = __header();
+        MemoryBlock* blocks = __blocks();
+        // The size check also keeps aligned_offset + bytes below from wrapping around
+        if (header.block_count == header.block_capacity || alignment > DATA_ALIGNMENT ||
+            bytes > _file_size - header.data_offset) {
+            throw std::bad_alloc();
+        }
+        std::uint64_t allocation_offset{header.data_offset};
+        for (std::size_t index = 0; index < header.block_count; ++index) {
+            std::uint64_t aligned_offset = __align_up(allocation_offset, alignment);
+            if (aligned_offset + bytes <= blocks[index].offset) {
+                std::memmove(blocks + index + 1, blocks + index, (header.block_count - index) * sizeof(MemoryBlock));
+                blocks[index] = MemoryBlock{aligned_offset, bytes};
+                ++header.block_count;
+                return _mapping + aligned_offset;
+            }
+            allocation_offset = blocks[index].offset + blocks[index].size;
+        }
+        throw std::bad_alloc();
+    }
+
+    void do_deallocate(void* ptr, std::size_t bytes, std::size_t /* alignment */) override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::size_t index = __find_block(ptr);
+        FileHeader& header = __header();
+        MemoryBlock* blocks = __blocks();
+        if (blocks[index].size != std::max<std::size_t>(bytes, 1)) {
+            throw std::logic_error("An attempt to free an incorrectly sized block.");
+        }
+        if (header.root.offset == blocks[index].offset) {
+            if (_root_attached) {
+                _root_attached = false;
+                return;
+            }
+            header.root = MappedRoot{};
+        }
+        std::memmove(blocks + index, blocks + index + 1, (header.block_count - index - 1) * sizeof(MemoryBlock));
+        --header.block_count;
+    }
+
+    bool do_try_expand(void* ptr, std::size_t old_size, std::size_t new_size, std::size_t /* alignment */) override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        old_size = std::max<std::size_t>(old_size, 1);
+        if (new_size <= old_size) {
+            return new_size == old_size;
+        }
+        std::size_t index = __find_block(ptr);
+        MemoryBlock* blocks = __blocks();
+        if (blocks[index].size != old_size) {
+            throw std::logic_error("An attempt to expand an incorrectly sized block.");
+        }
+        if (blocks[index + 1].offset - blocks[index].offset < new_size) {
+            return false;
+        }
+        blocks[index].size = new_size;
+        MappedRoot& root = __header().root;
+        if (root.offset == blocks[index].offset) {
+            root.capacity = new_size / root.item_size;
+        }
+        return true;
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+// Hands the stack's storage over to the file's root slot and flushes the mapping. A previously
+// saved array is freed unless a loaded stack still owns it. The stack must allocate from this
+// resource and is left empty.
+template<typename T, std::size_t INLINE_CAPACITY>
+requires std::is_trivially_copyable_v<T>
+void save_stack(MappedMemoryResource& memory_resource,
+                CustomStack<T, std::pmr::polymorphic_allocator<T>, INLINE_CAPACITY>& stack) {
+    if (stack.get_allocator().resource() != &memory_resource) {
+        throw std::logic_error("The stack does not allocate from this resource.");
+    }
+    MappedRoot& root = memory_resource.root();
+    auto storage = stack.release();
+    if (root.offset != 0 && !memory_resource.root_attached()) {
+        memory_resource.deallocate(memory_resource.address_of(root.offset), root.capacity * root.item_size, alignof(T));
+    }
+    root = MappedRoot{};
+    memory_resource.set_root_attached(false);
+    if (storage.data) {
+        root = MappedRoot{memory_resource.offset_of(storage.data), storage.size, storage.capacity, sizeof(T)};
+    }
+    memory_resource.flush();
+}
+
+// Reattaches the stack saved in the root slot, or returns an empty one when there is none or it
+// is already attached to another stack. The slot keeps the saved array until a stack is saved
+// again, so neither a crash nor a clean exit without save_stack loses the data or the block.
+template<typename T>
+requires std::is_trivially_copyable_v<T>
+CustomStack<T, std::pmr::polymorphic_allocator<T>> load_stack(MappedMemoryResource& memory_resource) {
+    using Stack = CustomStack<T, std::pmr::polymorphic_allocator<T>>;
+    MappedRoot& root = memory_resource.root();
+    if (root.offset == 0 || memory_resource.root_attached()) {
+        return Stack(&memory_resource);
+    }
+    if (root.item_size != sizeof(T)) {
+        throw std::logic_error("The saved stack holds items of another size.");
+    }
+    typename Stack::Storage storage{
+        static_cast<T*>(memory_resource.address_of(root.offset)),
+        static_cast<std::size_t>(root.size),
+        static_cast<std::size_t>(root.capacity)
+    };
+    Stack stack(storage, &memory_resource);
+    memory_resource.set_root_attached(true);
+    return stack;
+}
+
+#endif
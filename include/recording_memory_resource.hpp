@@ -0,0 +1,250 @@
+#ifndef RECORDING_MEMORY_RESOURCE_HPP
+#define RECORDING_MEMORY_RESOURCE_HPP
+
+#include "expandable_memory_resource.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory_resource>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+enum class TraceEvent: std::uint8_t {
+    allocate,
+    deallocate,
+    expand      // a successful try_expand; size is the new size
+};
+
+// One fixed-size record of the binary trace. Blocks are identified by the ordinal of the
+// allocation that produced them, so traces do not depend on addresses.
+struct TraceRecord {
+    std::uint64_t timestamp{0};     // nanoseconds since the recording started
+    std::uint64_t id{0};
+    std::uint64_t size{0};
+    std::uint32_t alignment{0};
+    TraceEvent event{TraceEvent::allocate};
+    std::uint8_t padding[3]{};
+};
+
+static_assert(sizeof(TraceRecord) == 32, "Trace records are written as raw bytes");
+
+inline constexpr char TRACE_MAGIC[8] = {'C', 'M', 'R', 'T', 'R', 'C', '0', '1'};
+
+// Forwards every request to the upstream resource and appends a TraceRecord for it to the file.
+// Records are collected in a buffer of buffer_records entries and written when it is full, on
+// flush() and on destruction, so the hot path only takes the lock and fills one record. On x86
+// the record is stamped with the time stamp counter, which is much cheaper to read than
+// steady_clock; the buffer is converted to nanoseconds when it is written, against steady_clock.
+class RecordingMemoryResource: public ExpandableMemoryResource {
+
+private:
+
+    std::pmr::memory_resource* _upstream;
+    std::FILE* _file{nullptr};
+    std::vector<TraceRecord> _buffer;
+    std::size_t _buffer_records;
+    std::unordered_map<void*, std::uint64_t> _ids;
+    std::uint64_t _next_id{0};
+    std::uint64_t _recorded{0};
+    std::chrono::steady_clock::time_point _started{std::chrono::steady_clock::now()};
+    std::uint64_t _started_ticks{__ticks()};
+    std::uint64_t _last_timestamp{0};
+    std::mutex _mutex;
+
+public:
+
+    explicit RecordingMemoryResource(const std::string& path,
+                                     std::pmr::memory_resource* upstream = std::pmr::get_default_resource(),
+                                     std::size_t buffer_records = 4096) :
+        _upstream(upstream),
+        _buffer_records(std::max<std::size_t>(buffer_records, 1))
+    {
+        _file = std::fopen(path.c_str(), "wb");
+        if (!_file) {
+            throw std::system_error(errno, std::generic_category(), "Cannot open " + path);
+        }
+        _buffer.reserve(_buffer_records);
+        if (std::fwrite(TRACE_MAGIC, sizeof(TRACE_MAGIC), 1, _file) != 1) {
+            std::fclose(_file);
+            throw std::system_error(errno, std::generic_category(), "Cannot write " + path);
+        }
+    }
+
+    RecordingMemoryResource(const RecordingMemoryResource&) = delete;
+    RecordingMemoryResource& operator=(const RecordingMemoryResource&) = delete;
+
+    // Writes what is still buffered; errors can no longer be reported here, call flush() first
+    ~RecordingMemoryResource() override {
+        __convert_timestamps();
+        std::fwrite(_buffer.data(), sizeof(TraceRecord), _buffer.size(), _file);
+        std::fclose(_file);
+    }
+
+public:
+
+    void flush() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        __write_buffer();
+        if (std::fflush(_file) != 0) {
+            throw std::system_error(errno, std::generic_category(), "Cannot write the trace");
+        }
+    }
+
+    std::pmr::memory_resource* upstream_resource() const {
+        return _upstream;
+    }
+
+    std::uint64_t recorded_events() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _recorded;
+    }
+
+private:
+
+    static std::uint64_t __ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+    }
+
+    // Buffered records hold raw ticks; the tick length is measured over the whole recording
+    // so far, and timestamps never go back across buffers
+    void __convert_timestamps() {
+        double elapsed_nanoseconds = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - _started).count();
+        std::uint64_t elapsed_ticks = __ticks() - _started_ticks;
+        double nanoseconds_per_tick = elapsed_ticks != 0 ? elapsed_nanoseconds / static_cast<double>(elapsed_ticks) : 0;
+        for (TraceRecord& record : _buffer) {
+            std::uint64_t timestamp = static_cast<std::uint64_t>(static_cast<double>(record.timestamp - _started_ticks) * nanoseconds_per_tick);
+            _last_timestamp = std::max(_last_timestamp, timestamp);
+            record.timestamp = _last_timestamp;
+        }
+    }
+
+    void __write_buffer() {
+        __convert_timestamps();
+        if (std::fwrite(_buffer.data(), sizeof(TraceRecord), _buffer.size(), _file) != _buffer.size()) {
+            throw std::system_error(errno, std::generic_category(), "Cannot write the trace");
+        }
+        _buffer.clear();
+    }
+
+    void __record(TraceEvent event, std::uint64_t id, std::size_t size, std::size_t alignment) {
+        if (_buffer.size() == _buffer_records) {
+            __write_buffer();
+        }
+        TraceRecord& record = _buffer.emplace_back();
+        record.timestamp = __ticks();
+        record.id = id;
+        record.size = size;
+        record.alignment = static_cast<std::uint32_t>(alignment);
+        record.event = event;
+        ++_recorded;
+    }
+
+    std::uint64_t __id_of(void* ptr) {
+        auto found = _ids.find(ptr);
+        if (found == _ids.end()) {
+            throw std::logic_error("An attempt to free an unallocated block.");
+        }
+        return found->second;
+    }
+
+    // Failed allocations are not recorded; the replay finds its own failures
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        void* ptr = _upstream->allocate(bytes, alignment);
+        std::lock_guard<std::mutex> lock(_mutex);
+        try {
+            _ids[ptr] = _next_id;
+            __record(TraceEvent::allocate, _next_id, bytes, alignment);
+        } catch (...) {
+            _ids.erase(ptr);
+            _upstream->deallocate(ptr, bytes, alignment);
+            throw;
+        }
+        ++_next_id;
+        return ptr;
+    }
+
+    void do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment) override {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            std::uint64_t id = __id_of(ptr);
+            __record(TraceEvent::deallocate, id, bytes, alignment);
+            _ids.erase(ptr);
+        }
+        _upstream->deallocate(ptr, bytes, alignment);
+    }
+
+    bool do_try_expand(void* ptr, std::size_t old_size, std::size_t new_size, std::size_t alignment) override {
+        auto* expandable = dynamic_cast<ExpandableMemoryResource*>(_upstream);
+        if (!expandable || !expandable->try_expand(ptr, old_size, new_size, alignment)) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        __record(TraceEvent::expand, __id_of(ptr), new_size, alignment);
+        return true;
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+// Reads a trace written by RecordingMemoryResource record by record
+class TraceReader {
+
+private:
+
+    std::FILE* _file{nullptr};
+
+public:
+
+    explicit TraceReader(const std::string& path) {
+        _file = std::fopen(path.c_str(), "rb");
+        if (!_file) {
+            throw std::system_error(errno, std::generic_category(), "Cannot open " + path);
+        }
+        char magic[sizeof(TRACE_MAGIC)];
+        if (std::fread(magic, sizeof(magic), 1, _file) != 1 || std::memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0) {
+            std::fclose(_file);
+            throw std::runtime_error("Not an allocation trace: " + path);
+        }
+    }
+
+    TraceReader(const TraceReader&) = delete;
+    TraceReader& operator=(const TraceReader&) = delete;
+
+    ~TraceReader() {
+        std::fclose(_file);
+    }
+
+    // Returns false at the end of the trace; a truncated last record is ignored
+    bool next(TraceRecord& record) {
+        return std::fread(&record, sizeof(TraceRecord), 1, _file) == 1;
+    }
+
+    std::vector<TraceRecord> read_all() {
+        std::vector<TraceRecord> records;
+        TraceRecord record;
+        while (next(record)) {
+            records.push_back(record);
+        }
+        return records;
+    }
+};
+
+#endif
@@ -0,0 +1,255 @@
+#ifndef SEGMENTED_CUSTOM_STACK_HPP
+#define SEGMENTED_CUSTOM_STACK_HPP
+
+#include <algorithm>
+#include <memory_resource>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+// Stack over a linked list of fixed-size chunks. Growth allocates one chunk and never moves
+// elements, so references to elements stay valid until they are popped and a fixed arena only has
+// to fit one more chunk, not old and new storage at once. The last chunk to empty is kept as a
+// spare so that pushes and pops around a chunk boundary do not allocate and free in turn.
+template <typename T, typename allocator_type,
+          std::size_t CHUNK_CAPACITY = std::max<std::size_t>(4, 256 / sizeof(T))>
+requires std::is_same_v<allocator_type, std::pmr::polymorphic_allocator<T>> && (CHUNK_CAPACITY > 0)
+class SegmentedCustomStack
+{
+    struct Chunk {
+        Chunk* below{nullptr};
+        Chunk* above{nullptr};
+        alignas(T) unsigned char storage[CHUNK_CAPACITY * sizeof(T)];
+
+        T* items() {
+            return std::launder(reinterpret_cast<T*>(storage));
+        }
+    };
+
+    using chunk_allocator_type = std::pmr::polymorphic_allocator<Chunk>;
+    using allocator_traits = std::allocator_traits<allocator_type>;
+
+private:
+
+    allocator_type _polymorphic_allocator;
+    Chunk* _bottom_chunk{nullptr};
+    Chunk* _top_chunk{nullptr};
+    Chunk* _spare_chunk{nullptr};
+    std::size_t _top_count{0};
+    std::size_t _size{0};
+    std::size_t _chunk_count{0};
+
+public:
+
+    using item_type = T;
+    using value_type = T;
+
+    SegmentedCustomStack(allocator_type alloc = {}) :
+        _polymorphic_allocator(alloc) {
+    }
+
+    SegmentedCustomStack(const SegmentedCustomStack& other, allocator_type alloc = {}) :
+        _polymorphic_allocator(alloc)
+    {
+        try {
+            other.for_each([this](const T& item) { push(item); });
+        } catch (...) {
+            clear();
+            shrink_to_fit();
+            throw;
+        }
+    }
+
+    SegmentedCustomStack(SegmentedCustomStack&& other) noexcept :
+        _polymorphic_allocator(other._polymorphic_allocator),
+        _bottom_chunk(std::exchange(other._bottom_chunk, nullptr)),
+        _top_chunk(std::exchange(other._top_chunk, nullptr)),
+        _spare_chunk(std::exchange(other._spare_chunk, nullptr)),
+        _top_count(std::exchange(other._top_count, 0)),
+        _size(std::exchange(other._size, 0)),
+        _chunk_count(std::exchange(other._chunk_count, 0)) {
+    }
+
+    // The allocator stays with the stack, chunks already held are reused
+    SegmentedCustomStack& operator=(const SegmentedCustomStack& other) {
+        if (this != &other) {
+            clear();
+            other.for_each([this](const T& item) { push(item); });
+        }
+        return *this;
+    }
+
+    // Takes the chunks over when both stacks allocate from the same resource
+    SegmentedCustomStack& operator=(SegmentedCustomStack&& other) {
+        if (this == &other) {
+            return *this;
+        }
+        clear();
+        if (_polymorphic_allocator == other._polymorphic_allocator) {
+            shrink_to_fit();
+            _bottom_chunk = std::exchange(other._bottom_chunk, nullptr);
+            _top_chunk = std::exchange(other._top_chunk, nullptr);
+            _top_count = std::exchange(other._top_count, 0);
+            _size = std::exchange(other._size, 0);
+            _chunk_count = std::exchange(other._chunk_count, 0);
+            return *this;
+        }
+        other.for_each([this](T& item) { push(std::move(item)); });
+        other.clear();
+        return *this;
+    }
+
+    ~SegmentedCustomStack() {
+        clear();
+        shrink_to_fit();
+    }
+
+private:
+
+    Chunk* __allocate_chunk() {
+        chunk_allocator_type chunk_allocator(_polymorphic_allocator.resource());
+        return std::construct_at(chunk_allocator.allocate(1));
+    }
+
+    void __deallocate_chunk(Chunk* chunk) {
+        chunk_allocator_type(_polymorphic_allocator.resource()).deallocate(chunk, 1);
+    }
+
+    void __push_chunk() {
+        Chunk* chunk = _spare_chunk ? std::exchange(_spare_chunk, nullptr) : __allocate_chunk();
+        chunk->below = _top_chunk;
+        chunk->above = nullptr;
+        if (_top_chunk) {
+            _top_chunk->above = chunk;
+        } else {
+            _bottom_chunk = chunk;
+        }
+        _top_chunk = chunk;
+        _top_count = 0;
+        ++_chunk_count;
+    }
+
+    // The emptied top chunk becomes the spare; an older spare goes back to the resource
+    void __pop_chunk() {
+        Chunk* chunk = _top_chunk;
+        _top_chunk = chunk->below;
+        if (_top_chunk) {
+            _top_chunk->above = nullptr;
+            _top_count = CHUNK_CAPACITY;
+        } else {
+            _bottom_chunk = nullptr;
+        }
+        --_chunk_count;
+        if (_spare_chunk) {
+            __deallocate_chunk(_spare_chunk);
+        }
+        _spare_chunk = chunk;
+    }
+
+public:
+
+    std::size_t size() const {
+        return _size;
+    }
+
+    bool empty() const {
+        return _size == 0;
+    }
+
+    // Chunks holding elements, the spare not included
+    std::size_t chunk_count() const {
+        return _chunk_count;
+    }
+
+    static constexpr std::size_t chunk_capacity() {
+        return CHUNK_CAPACITY;
+    }
+
+    template<typename... Args>
+    T& emplace(Args&&... args) {
+        if (!_top_chunk || _top_count == CHUNK_CAPACITY) {
+            __push_chunk();
+            try {
+                allocator_traits::construct(_polymorphic_allocator, _top_chunk->items(), std::forward<Args>(args)...);
+            } catch (...) {
+                __pop_chunk();
+                throw;
+            }
+        } else {
+            allocator_traits::construct(_polymorphic_allocator, _top_chunk->items() + _top_count, std::forward<Args>(args)...);
+        }
+        ++_size;
+        return _top_chunk->items()[_top_count++];
+    }
+
+    void push(const T& item) {
+        emplace(item);
+    }
+
+    void push(T&& item) {
+        emplace(std::move(item));
+    }
+
+    void pop() {
+        if (empty()) {
+            throw std::out_of_range("Stack is empty");
+        }
+        --_size;
+        allocator_traits::destroy(_polymorphic_allocator, _top_chunk->items() + --_top_count);
+        if (_top_count == 0) {
+            __pop_chunk();
+        }
+    }
+
+    T& top() {
+        if (empty()) {
+            throw std::out_of_range("Stack is empty");
+        }
+        return _top_chunk->items()[_top_count - 1];
+    }
+
+    const T& top() const {
+        if (empty()) {
+            throw std::out_of_range("Stack is empty");
+        }
+        return _top_chunk->items()[_top_count - 1];
+    }
+
+    void clear() {
+        while (!empty()) {
+            pop();
+        }
+    }
+
+    // Returns the spare chunk to the resource
+    void shrink_to_fit() {
+        if (_spare_chunk) {
+            __deallocate_chunk(std::exchange(_spare_chunk, nullptr));
+        }
+    }
+
+    // Visits the elements from bottom to top
+    template<typename Function>
+    void for_each(Function function) {
+        for (Chunk* chunk = _bottom_chunk; chunk; chunk = chunk->above) {
+            std::size_t count = chunk == _top_chunk ? _top_count : CHUNK_CAPACITY;
+            for (std::size_t index = 0; index < count; ++index) {
+                function(chunk->items()[index]);
+            }
+        }
+    }
+
+    template<typename Function>
+    void for_each(Function function) const {
+        for (Chunk* chunk = _bottom_chunk; chunk; chunk = chunk->above) {
+            std::size_t count = chunk == _top_chunk ? _top_count : CHUNK_CAPACITY;
+            for (std::size_t index = 0; index < count; ++index) {
+                function(static_cast<const T&>(chunk->items()[index]));
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,289 @@
+#ifndef TASK_SCHEDULER_HPP
+#define TASK_SCHEDULER_HPP
+
+#include "custom_stack.hpp"
+#include "work_stealing_deque.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Completion counter for a batch of tasks; the first exception thrown by one of them is kept
+// and rethrown by TaskScheduler::wait
+class TaskGroup {
+
+    friend class TaskScheduler;
+
+private:
+
+    std::atomic<std::size_t> _pending{0};
+    std::mutex _mutex;
+    // Threads outside the pool sleep here until the last task finishes
+    std::condition_variable _finished;
+    std::exception_ptr _exception;
+
+public:
+
+    bool done() const {
+        return _pending.load(std::memory_order_acquire) == 0;
+    }
+};
+
+// Thread pool where every worker owns a WorkStealingDeque of tasks. Tasks spawned from a worker go
+// to its own deque and run newest first; an idle worker steals the oldest task of another
+// worker, which for recursive jobs is the largest piece of work left. Only tasks spawned from
+// outside the pool go through a shared inbox.
+class TaskScheduler {
+
+    struct Task {
+        std::function<void()> body;
+        TaskGroup* group;
+    };
+
+    using TaskDeque = WorkStealingDeque<Task*, std::pmr::polymorphic_allocator<Task*>>;
+
+    struct Worker {
+        TaskDeque deque;
+        std::atomic<std::size_t> steals{0};
+        // Where the next steal attempt starts; only the worker's own thread touches it
+        std::size_t next_victim;
+
+        Worker(std::pmr::memory_resource* memory_resource, std::size_t index, std::size_t worker_count) :
+            deque(memory_resource),
+            next_victim((index + 1) % worker_count) {
+        }
+    };
+
+    struct WorkerContext {
+        TaskScheduler* scheduler{nullptr};
+        std::size_t index{0};
+    };
+
+private:
+
+    std::pmr::memory_resource* _memory_resource;
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::vector<std::thread> _threads;
+
+    std::mutex _inbox_mutex;
+    CustomStack<Task*, std::pmr::polymorphic_allocator<Task*>> _inbox;
+
+    // Workers with nothing to do sleep until a task is queued anywhere
+    std::atomic<std::size_t> _queued{0};
+    std::atomic<std::size_t> _sleeping{0};
+    std::mutex _sleep_mutex;
+    std::condition_variable _wake_up;
+    std::atomic<bool> _stopping{false};
+
+public:
+
+    explicit TaskScheduler(std::size_t worker_count = std::thread::hardware_concurrency(),
+                           std::pmr::memory_resource* memory_resource = std::pmr::get_default_resource()) :
+        _memory_resource(memory_resource),
+        _inbox(memory_resource)
+    {
+        worker_count = std::max(worker_count, std::size_t{1});
+        for (std::size_t index = 0; index < worker_count; ++index) {
+            _workers.push_back(std::make_unique<Worker>(memory_resource, index, worker_count));
+        }
+        for (std::size_t index = 0; index < worker_count; ++index) {
+            _threads.emplace_back([this, index] { __worker_loop(index); });
+        }
+    }
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    // Tasks still queued when the pool stops are destroyed without running; their groups never
+    // complete
+    ~TaskScheduler() {
+        {
+            std::lock_guard<std::mutex> lock(_sleep_mutex);
+            _stopping.store(true);
+        }
+        _wake_up.notify_all();
+        for (std::thread& thread : _threads) {
+            thread.join();
+        }
+        std::pmr::polymorphic_allocator<Task> task_allocator(_memory_resource);
+        for (std::unique_ptr<Worker>& worker : _workers) {
+            while (std::optional<Task*> task = worker->deque.pop()) {
+                task_allocator.delete_object(*task);
+            }
+        }
+        while (!_inbox.empty()) {
+            task_allocator.delete_object(_inbox.top());
+            _inbox.pop();
+        }
+    }
+
+    std::size_t worker_count() const {
+        return _workers.size();
+    }
+
+    // Tasks taken from another worker's deque since the pool started
+    std::size_t steal_count() const {
+        std::size_t steals{0};
+        for (const std::unique_ptr<Worker>& worker : _workers) {
+            steals += worker->steals.load(std::memory_order_relaxed);
+        }
+        return steals;
+    }
+
+    void spawn(TaskGroup& group, std::function<void()> body) {
+        std::pmr::polymorphic_allocator<Task> task_allocator(_memory_resource);
+        Task* task = task_allocator.new_object<Task>(std::move(body), &group);
+        group._pending.fetch_add(1, std::memory_order_relaxed);
+        _queued.fetch_add(1);
+        WorkerContext& context = __context();
+        if (context.scheduler == this) {
+            _workers[context.index]->deque.push(task);
+        } else {
+            std::lock_guard<std::mutex> lock(_inbox_mutex);
+            _inbox.push(task);
+        }
+        if (_sleeping.load() != 0) {
+            { std::lock_guard<std::mutex> lock(_sleep_mutex); }
+            _wake_up.notify_one();
+        }
+    }
+
+    // Blocks until every task of the group has finished; a worker runs other tasks meanwhile,
+    // any other thread sleeps
+    void wait(TaskGroup& group) {
+        WorkerContext& context = __context();
+        if (context.scheduler == this) {
+            while (!group.done()) {
+                if (!__run_one(context.index)) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+        std::exception_ptr exception;
+        {
+            std::unique_lock<std::mutex> lock(group._mutex);
+            group._finished.wait(lock, [&group] { return group.done(); });
+            exception = std::exchange(group._exception, nullptr);
+        }
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+    }
+
+    // Calls body(i) for every i in [begin, end), halving the range until it is at most grain long
+    template<typename Body>
+    void parallel_for(std::size_t begin, std::size_t end, std::size_t grain, Body body) {
+        TaskGroup group;
+        grain = std::max(grain, std::size_t{1});
+        spawn(group, [this, &group, &body, begin, end, grain] {
+            __split(group, body, begin, end, grain);
+        });
+        wait(group);
+    }
+
+private:
+
+    static WorkerContext& __context() {
+        static thread_local WorkerContext context;
+        return context;
+    }
+
+    template<typename Body>
+    void __split(TaskGroup& group, Body& body, std::size_t begin, std::size_t end, std::size_t grain) {
+        while (end - begin > grain) {
+            std::size_t middle = begin + (end - begin) / 2;
+            spawn(group, [this, &group, &body, middle, end, grain] {
+                __split(group, body, middle, end, grain);
+            });
+            end = middle;
+        }
+        for (std::size_t index = begin; index < end; ++index) {
+            body(index);
+        }
+    }
+
+    Task* __find_task(std::size_t index) {
+        if (std::optional<Task*> task = _workers[index]->deque.pop()) {
+            return *task;
+        }
+        // Start from a different victim on every call so thieves spread out
+        std::size_t& next_victim = _workers[index]->next_victim;
+        for (std::size_t attempt = 0; attempt < _workers.size(); ++attempt) {
+            std::size_t victim = (next_victim + attempt) % _workers.size();
+            if (victim == index) {
+                continue;
+            }
+            if (std::optional<Task*> task = _workers[victim]->deque.steal()) {
+                next_victim = victim;
+                _workers[index]->steals.fetch_add(1, std::memory_order_relaxed);
+                return *task;
+            }
+        }
+        next_victim = (next_victim + 1) % _workers.size();
+        std::lock_guard<std::mutex> lock(_inbox_mutex);
+        if (_inbox.empty()) {
+            return nullptr;
+        }
+        Task* task = _inbox.top();
+        _inbox.pop();
+        return task;
+    }
+
+    bool __run_one(std::size_t index) {
+        Task* task = __find_task(index);
+        if (!task) {
+            return false;
+        }
+        _queued.fetch_sub(1);
+        try {
+            task->body();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(task->group->_mutex);
+            if (!task->group->_exception) {
+                task->group->_exception = std::current_exception();
+            }
+        }
+        TaskGroup* group = task->group;
+        std::pmr::polymorphic_allocator<Task>(_memory_resource).delete_object(task);
+        __finish(*group);
+        return true;
+    }
+
+    // The last task of a group counts down under the group's lock, so a waiter cannot see it
+    // done, return and destroy the group before it has been notified
+    static void __finish(TaskGroup& group) {
+        std::size_t pending = group._pending.load(std::memory_order_relaxed);
+        while (pending > 1) {
+            if (group._pending.compare_exchange_weak(pending, pending - 1, std::memory_order_acq_rel)) {
+                return;
+            }
+        }
+        std::lock_guard<std::mutex> lock(group._mutex);
+        group._pending.fetch_sub(1, std::memory_order_acq_rel);
+        group._finished.notify_all();
+    }
+
+    void __worker_loop(std::size_t index) {
+        __context() = WorkerContext{this, index};
+        while (!_stopping.load(std::memory_order_relaxed)) {
+            if (__run_one(index)) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(_sleep_mutex);
+            _sleeping.fetch_add(1);
+            _wake_up.wait(lock, [this] { return _queued.load() != 0 || _stopping.load(); });
+            _sleeping.fetch_sub(1);
+        }
+    }
+};
+
+#endif
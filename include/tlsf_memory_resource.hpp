@@ -0,0 +1,319 @@
+#ifndef TLSF_MEMORY_RESOURCE_HPP
+#define TLSF_MEMORY_RESOURCE_HPP
+
+#include "expandable_memory_resource.hpp"
+
+#include <memory_resource>
+#include <array>
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <exception>
+#include <stdexcept>
+#include <mutex>
+
+// Two-level segregated fit allocator: free blocks are kept in size-segregated lists indexed by
+// a first-level (power of two) and second-level (linear subdivision) bitmap, so finding a block,
+// splitting it and coalescing it with its physical neighbours on free are all O(1).
+class TlsfMemoryResource: public ExpandableMemoryResource {
+
+    // Boundary tag placed in front of every block; the free list links live in the payload
+    struct BlockHeader {
+        std::size_t prev_size{0};
+        std::size_t size{0};
+    };
+
+    struct FreeBlock {
+        BlockHeader header;
+        FreeBlock* next_free{nullptr};
+        FreeBlock* prev_free{nullptr};
+    };
+
+private:
+
+    static constexpr std::size_t ALIGNMENT{16};
+    static constexpr std::size_t ALIGNMENT_LOG2{4};
+    static constexpr std::size_t HEADER_SIZE{sizeof(BlockHeader)};
+    static constexpr std::size_t MIN_BLOCK_SIZE{sizeof(FreeBlock)};
+    static constexpr std::size_t FREE_FLAG{1};
+    static constexpr std::size_t SL_INDEX_COUNT_LOG2{4};
+    static constexpr std::size_t SL_INDEX_COUNT{1 << SL_INDEX_COUNT_LOG2};
+    static constexpr std::size_t FL_INDEX_SHIFT{SL_INDEX_COUNT_LOG2 + ALIGNMENT_LOG2};
+    static constexpr std::size_t SMALL_BLOCK_SIZE{1 << FL_INDEX_SHIFT};
+    static constexpr std::size_t FL_INDEX_COUNT{64 - FL_INDEX_SHIFT + 1};
+
+    static_assert(HEADER_SIZE == ALIGNMENT, "Block payloads must stay aligned");
+
+    std::pmr::memory_resource* _upstream;
+    std::size_t _buffer_size;
+    char* _buffer;
+    std::uint64_t _fl_bitmap{0};
+    std::array<std::uint32_t, FL_INDEX_COUNT> _sl_bitmap{};
+    std::array<std::array<FreeBlock*, SL_INDEX_COUNT>, FL_INDEX_COUNT> _free_blocks{};
+    std::mutex _mutex;
+
+public:
+
+    explicit TlsfMemoryResource(std::size_t buffer_size = 1024,
+                                std::pmr::memory_resource* upstream = std::pmr::get_default_resource()) :
+        _upstream(upstream),
+        _buffer_size(__align_up(std::max(buffer_size, MIN_BLOCK_SIZE + HEADER_SIZE), ALIGNMENT)),
+        _buffer(static_cast<char*>(_upstream->allocate(_buffer_size, ALIGNMENT)))
+    {
+        BlockHeader* sentinel = ::new (_buffer + _buffer_size - HEADER_SIZE) BlockHeader{};
+        FreeBlock* block = ::new (_buffer) FreeBlock{};
+        block->header.size = _buffer_size - HEADER_SIZE;
+        sentinel->prev_size = block->header.size;
+        __insert_free(block);
+    }
+
+    TlsfMemoryResource(const TlsfMemoryResource&) = delete;
+    TlsfMemoryResource& operator=(const TlsfMemoryResource&) = delete;
+
+    ~TlsfMemoryResource() override {
+        _upstream->deallocate(_buffer, _buffer_size, ALIGNMENT);
+    }
+
+public:
+
+    std::size_t _get_buffer_size() const {
+        return _buffer_size;
+    }
+
+private:
+
+    static constexpr std::size_t __align_up(std::size_t value, std::size_t alignment) {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+
+    static std::size_t __block_size(const BlockHeader* block) {
+        return block->size & ~FREE_FLAG;
+    }
+
+    static bool __is_free(const BlockHeader* block) {
+        return block->size & FREE_FLAG;
+    }
+
+    static BlockHeader* __next_physical(BlockHeader* block) {
+        return reinterpret_cast<BlockHeader*>(reinterpret_cast<char*>(block) + __block_size(block));
+    }
+
+    BlockHeader* __prev_physical(BlockHeader* block) const {
+        if (block->prev_size == 0) {
+            return nullptr;
+        }
+        return reinterpret_cast<BlockHeader*>(reinterpret_cast<char*>(block) - block->prev_size);
+    }
+
+    static void __mapping_insert(std::size_t size, std::size_t& fl, std::size_t& sl) {
+        if (size < SMALL_BLOCK_SIZE) {
+            fl = 0;
+            sl = size / (SMALL_BLOCK_SIZE / SL_INDEX_COUNT);
+        } else {
+            std::size_t top_bit = std::bit_width(size) - 1;
+            sl = (size >> (top_bit - SL_INDEX_COUNT_LOG2)) ^ SL_INDEX_COUNT;
+            fl = top_bit - FL_INDEX_SHIFT + 1;
+        }
+    }
+
+    // Rounds the size up to the next list boundary, so any block found there is large enough
+    static void __mapping_search(std::size_t size, std::size_t& fl, std::size_t& sl) {
+        if (size >= SMALL_BLOCK_SIZE) {
+            size += (std::size_t{1} << (std::bit_width(size) - 1 - SL_INDEX_COUNT_LOG2)) - 1;
+        }
+        __mapping_insert(size, fl, sl);
+    }
+
+    void __insert_free(FreeBlock* block) {
+        std::size_t fl, sl;
+        __mapping_insert(__block_size(&block->header), fl, sl);
+        block->header.size |= FREE_FLAG;
+        block->prev_free = nullptr;
+        block->next_free = _free_blocks[fl][sl];
+        if (block->next_free) {
+            block->next_free->prev_free = block;
+        }
+        _free_blocks[fl][sl] = block;
+        _fl_bitmap |= std::uint64_t{1} << fl;
+        _sl_bitmap[fl] |= std::uint32_t{1} << sl;
+    }
+
+    void __remove_free(FreeBlock* block) {
+        std::size_t fl, sl;
+        __mapping_insert(__block_size(&block->header), fl, sl);
+        if (block->prev_free) {
+            block->prev_free->next_free = block->next_free;
+        } else {
+            _free_blocks[fl][sl] = block->next_free;
+        }
+        if (block->next_free) {
+            block->next_free->prev_free = block->prev_free;
+        }
+        if (!_free_blocks[fl][sl]) {
+            _sl_bitmap[fl] &= ~(std::uint32_t{1} << sl);
+            if (!_sl_bitmap[fl]) {
+                _fl_bitmap &= ~(std::uint64_t{1} << fl);
+            }
+        }
+        block->header.size &= ~FREE_FLAG;
+    }
+
+    FreeBlock* __find_suitable(std::size_t size) {
+        std::size_t fl, sl;
+        __mapping_search(size, fl, sl);
+        if (fl >= FL_INDEX_COUNT) {
+            return nullptr;
+        }
+        std::uint32_t sl_map = _sl_bitmap[fl] & (~std::uint32_t{0} << sl);
+        if (!sl_map) {
+            std::uint64_t fl_map = fl + 1 < FL_INDEX_COUNT ? _fl_bitmap & (~std::uint64_t{0} << (fl + 1)) : 0;
+            if (!fl_map) {
+                return nullptr;
+            }
+            fl = std::countr_zero(fl_map);
+            sl_map = _sl_bitmap[fl];
+        }
+        return _free_blocks[fl][std::countr_zero(sl_map)];
+    }
+
+    // Cuts the tail of a used block off into a free block if it is large enough to stand alone
+    void __split(BlockHeader* block, std::size_t size) {
+        std::size_t block_size = __block_size(block);
+        if (block_size - size < MIN_BLOCK_SIZE) {
+            return;
+        }
+        FreeBlock* remainder = ::new (reinterpret_cast<char*>(block) + size) FreeBlock{};
+        remainder->header.prev_size = size;
+        remainder->header.size = block_size - size;
+        block->size = size;
+        __next_physical(&remainder->header)->prev_size = remainder->header.size;
+        __insert_free(__coalesce_next(remainder));
+    }
+
+    FreeBlock* __coalesce_next(FreeBlock* block) {
+        BlockHeader* next = __next_physical(&block->header);
+        if (__is_free(next)) {
+            __remove_free(reinterpret_cast<FreeBlock*>(next));
+            block->header.size = __block_size(&block->header) + __block_size(next);
+            __next_physical(&block->header)->prev_size = block->header.size;
+        }
+        return block;
+    }
+
+    FreeBlock* __coalesce_prev(FreeBlock* block) {
+        BlockHeader* prev = __prev_physical(&block->header);
+        if (prev && __is_free(prev)) {
+            __remove_free(reinterpret_cast<FreeBlock*>(prev));
+            prev->size = __block_size(prev) + __block_size(&block->header);
+            __next_physical(prev)->prev_size = prev->size;
+            return reinterpret_cast<FreeBlock*>(prev);
+        }
+        return block;
+    }
+
+    // A pointer into the middle of a block would read its header from user data, so the boundary
+    // tags have to agree with both physical neighbours
+    bool __is_block_start(BlockHeader* block) const {
+        char* address = reinterpret_cast<char*>(block);
+        std::size_t offset = static_cast<std::size_t>(address - _buffer);
+        std::size_t size = __block_size(block);
+        if (size < MIN_BLOCK_SIZE || size % ALIGNMENT != 0 || size > _buffer_size - HEADER_SIZE - offset ||
+            __next_physical(block)->prev_size != size) {
+            return false;
+        }
+        if (block->prev_size == 0) {
+            return offset == 0;
+        }
+        return block->prev_size % ALIGNMENT == 0 && block->prev_size <= offset &&
+               __block_size(__prev_physical(block)) == block->prev_size;
+    }
+
+    BlockHeader* __header_of(void* ptr) {
+        char* address = static_cast<char*>(ptr);
+        if (address < _buffer + HEADER_SIZE || address >= _buffer + _buffer_size ||
+            reinterpret_cast<std::uintptr_t>(address) % ALIGNMENT != 0 ||
+            !__is_block_start(reinterpret_cast<BlockHeader*>(address - HEADER_SIZE))) {
+            throw std::logic_error("An attempt to free an unallocated block.");
+        }
+        return reinterpret_cast<BlockHeader*>(address - HEADER_SIZE);
+    }
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        // Also keeps the size arithmetic below from wrapping around
+        if (bytes > _buffer_size || alignment > _buffer_size) {
+            throw std::bad_alloc();
+        }
+        std::size_t size = std::max(__align_up(bytes, ALIGNMENT) + HEADER_SIZE, MIN_BLOCK_SIZE);
+        std::size_t padding = alignment > ALIGNMENT ? alignment + MIN_BLOCK_SIZE : 0;
+        FreeBlock* free_block = __find_suitable(size + padding);
+        if (!free_block) {
+            throw std::bad_alloc();
+        }
+        __remove_free(free_block);
+        BlockHeader* block = &free_block->header;
+        if (padding) {
+            std::uintptr_t payload = reinterpret_cast<std::uintptr_t>(block) + HEADER_SIZE;
+            std::size_t gap = __align_up(payload, alignment) - payload;
+            if (gap != 0 && gap < MIN_BLOCK_SIZE) {
+                gap = __align_up(payload + MIN_BLOCK_SIZE, alignment) - payload;
+            }
+            if (gap != 0) {
+                BlockHeader* aligned = reinterpret_cast<BlockHeader*>(reinterpret_cast<char*>(block) + gap);
+                aligned->prev_size = gap;
+                aligned->size = __block_size(block) - gap;
+                block->size = gap;
+                __next_physical(aligned)->prev_size = aligned->size;
+                __insert_free(__coalesce_prev(reinterpret_cast<FreeBlock*>(block)));
+                block = aligned;
+            }
+        }
+        __split(block, size);
+        return reinterpret_cast<char*>(block) + HEADER_SIZE;
+    }
+
+    void do_deallocate(void* ptr, std::size_t bytes, std::size_t /* alignment */) override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        BlockHeader* block = __header_of(ptr);
+        if (__is_free(block)) {
+            throw std::logic_error("An attempt to free an unallocated block.");
+        }
+        if (bytes > __block_size(block) || __align_up(bytes, ALIGNMENT) + HEADER_SIZE > __block_size(block)) {
+            throw std::logic_error("An attempt to free an incorrectly sized block.");
+        }
+        FreeBlock* free_block = reinterpret_cast<FreeBlock*>(block);
+        __insert_free(__coalesce_next(__coalesce_prev(free_block)));
+    }
+
+    // Absorbs the following block when it is free and together they are large enough
+    bool do_try_expand(void* ptr, std::size_t old_size, std::size_t new_size, std::size_t /* alignment */) override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        BlockHeader* block = __header_of(ptr);
+        if (__is_free(block) || old_size > __block_size(block) ||
+            __align_up(old_size, ALIGNMENT) + HEADER_SIZE > __block_size(block)) {
+            throw std::logic_error("An attempt to expand an unallocated block.");
+        }
+        if (new_size > _buffer_size) {
+            return false;
+        }
+        std::size_t size = std::max(__align_up(new_size, ALIGNMENT) + HEADER_SIZE, MIN_BLOCK_SIZE);
+        if (size <= __block_size(block)) {
+            return true;
+        }
+        BlockHeader* next = __next_physical(block);
+        if (!__is_free(next) || __block_size(block) + __block_size(next) < size) {
+            return false;
+        }
+        __remove_free(reinterpret_cast<FreeBlock*>(next));
+        block->size = __block_size(block) + __block_size(next);
+        __next_physical(block)->prev_size = block->size;
+        __split(block, size);
+        return true;
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+#endif
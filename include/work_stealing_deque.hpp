@@ -0,0 +1,183 @@
+#ifndef WORK_STEALING_DEQUE_HPP
+#define WORK_STEALING_DEQUE_HPP
+
+#include "custom_stack.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <memory_resource>
+#include <memory>
+#include <optional>
+#include <type_traits>
+
+// Chase-Lev deque: the owner thread pushes and pops at the bottom like a CustomStack, any other
+// thread steals the oldest item from the top. Items sit in a circular buffer taken from the
+// polymorphic allocator. Growing copies the live range into a buffer twice as large and keeps the
+// old one alive until the deque dies, so a thief still reading it never waits for the owner.
+template <typename T, typename allocator_type>
+requires std::is_same_v<allocator_type, std::pmr::polymorphic_allocator<T>>
+      && std::is_trivially_copyable_v<T>
+class WorkStealingDeque
+{
+    struct Buffer {
+        std::int64_t capacity;
+        std::atomic<T>* slots;
+
+        T get(std::int64_t index) const {
+            return slots[index & (capacity - 1)].load(std::memory_order_relaxed);
+        }
+
+        void put(std::int64_t index, T item) {
+            slots[index & (capacity - 1)].store(item, std::memory_order_relaxed);
+        }
+    };
+
+    using slot_allocator_type = std::pmr::polymorphic_allocator<std::atomic<T>>;
+    using buffer_allocator_type = std::pmr::polymorphic_allocator<Buffer>;
+
+private:
+
+    static constexpr std::size_t INITIAL_CAPACITY{64};
+
+    allocator_type _polymorphic_allocator;
+    std::atomic<std::int64_t> _top{0};
+    std::atomic<std::int64_t> _bottom{0};
+    std::atomic<Buffer*> _buffer{nullptr};
+    CustomStack<Buffer*, std::pmr::polymorphic_allocator<Buffer*>> _retired;
+
+public:
+
+    using item_type = T;
+
+    WorkStealingDeque(std::size_t capacity, allocator_type alloc = {}) :
+        _polymorphic_allocator(alloc),
+        _retired(0, alloc.resource())
+    {
+        _buffer.store(__make_buffer(std::bit_ceil(std::max(capacity, std::size_t{1}))), std::memory_order_relaxed);
+    }
+
+    WorkStealingDeque(allocator_type alloc = {}) :
+        WorkStealingDeque::WorkStealingDeque(INITIAL_CAPACITY, alloc) {
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    ~WorkStealingDeque() {
+        __free_buffer(_buffer.load(std::memory_order_relaxed));
+        for (Buffer* buffer : _retired) {
+            __free_buffer(buffer);
+        }
+    }
+
+private:
+
+    Buffer* __make_buffer(std::size_t capacity) {
+        slot_allocator_type slot_allocator(_polymorphic_allocator.resource());
+        std::atomic<T>* slots = slot_allocator.allocate(capacity);
+        std::uninitialized_default_construct_n(slots, capacity);
+        buffer_allocator_type buffer_allocator(_polymorphic_allocator.resource());
+        try {
+            Buffer* buffer = buffer_allocator.allocate(1);
+            return std::construct_at(buffer, static_cast<std::int64_t>(capacity), slots);
+        } catch (...) {
+            slot_allocator.deallocate(slots, capacity);
+            throw;
+        }
+    }
+
+    void __free_buffer(Buffer* buffer) {
+        slot_allocator_type(_polymorphic_allocator.resource()).deallocate(buffer->slots, buffer->capacity);
+        buffer_allocator_type(_polymorphic_allocator.resource()).deallocate(buffer, 1);
+    }
+
+    // Only the owner grows the buffer; the old one is retired, not freed
+    Buffer* __grow(Buffer* buffer, std::int64_t top, std::int64_t bottom) {
+        Buffer* grown = __make_buffer(static_cast<std::size_t>(buffer->capacity) * 2);
+        for (std::int64_t index = top; index < bottom; ++index) {
+            grown->put(index, buffer->get(index));
+        }
+        try {
+            _retired.push(buffer);
+        } catch (...) {
+            __free_buffer(grown);
+            throw;
+        }
+        _buffer.store(grown, std::memory_order_release);
+        return grown;
+    }
+
+public:
+
+    // Owner only
+    void push(T item) {
+        std::int64_t bottom = _bottom.load(std::memory_order_relaxed);
+        std::int64_t top = _top.load(std::memory_order_acquire);
+        Buffer* buffer = _buffer.load(std::memory_order_relaxed);
+        if (bottom - top >= buffer->capacity) {
+            buffer = __grow(buffer, top, bottom);
+        }
+        buffer->put(bottom, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        _bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+
+    // Owner only; takes the newest item
+    std::optional<T> pop() {
+        std::int64_t bottom = _bottom.load(std::memory_order_relaxed) - 1;
+        Buffer* buffer = _buffer.load(std::memory_order_relaxed);
+        _bottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::int64_t top = _top.load(std::memory_order_relaxed);
+        if (top > bottom) {
+            _bottom.store(bottom + 1, std::memory_order_relaxed);
+            return std::nullopt;
+        }
+        T item = buffer->get(bottom);
+        if (top == bottom) {
+            // Last item: race the thieves for it
+            bool won = _top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                                    std::memory_order_relaxed);
+            _bottom.store(bottom + 1, std::memory_order_relaxed);
+            if (!won) {
+                return std::nullopt;
+            }
+        }
+        return item;
+    }
+
+    // Any thread; takes the oldest item, fails spuriously when it loses a race
+    std::optional<T> steal() {
+        std::int64_t top = _top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::int64_t bottom = _bottom.load(std::memory_order_acquire);
+        if (top >= bottom) {
+            return std::nullopt;
+        }
+        T item = _buffer.load(std::memory_order_acquire)->get(top);
+        if (!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                          std::memory_order_relaxed)) {
+            return std::nullopt;
+        }
+        return item;
+    }
+
+    // A snapshot; exact only when no other thread touches the deque
+    std::size_t size() const {
+        std::int64_t bottom = _bottom.load(std::memory_order_relaxed);
+        std::int64_t top = _top.load(std::memory_order_relaxed);
+        return bottom > top ? static_cast<std::size_t>(bottom - top) : 0;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    std::size_t capacity() const {
+        return static_cast<std::size_t>(_buffer.load(std::memory_order_relaxed)->capacity);
+    }
+};
+
+#endif
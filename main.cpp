@@ -1,5 +1,9 @@
 #include "./include/custom_memory_resource.hpp"
 #include "./include/custom_stack.hpp"
+#include "./include/task_scheduler.hpp"
+
+#include <numeric>
+#include <vector>
 
 int main() {
     std::cout << "\n1. Создание пользовательского memory_resource:" << std::endl;
@@ -24,18 +28,20 @@ int main() {
     custom_stack2 = new CustomStack<int, std::pmr::polymorphic_allocator<int>>(10, polymorphic_allocator);
     custom_stack3 = new CustomStack<int, std::pmr::polymorphic_allocator<int>>(10, polymorphic_allocator);
     custom_stack4 = new CustomStack<int, std::pmr::polymorphic_allocator<int>>(10, polymorphic_allocator);
+    custom_stack4->enable_relocation();
     std::cout << "   Четыре стека созданы" << std::endl;
 
     std::cout << "\n4. Освобождение части стеков:" << std::endl;
     delete custom_stack2;
     delete custom_stack3;
     std::cout << "   Два стека освобождены" << std::endl;
+    std::cout << "   Перемещено блоков при дефрагментации: " << custom_memory_resource.compact() << std::endl;
 
     std::cout << "\n5. Циклическое создание и использование стеков:" << std::endl;
     for (int iteration = 0; iteration < 10; ++iteration) {
         std::cout << "   Итерация " << iteration << ":" << std::endl;
         
-        CustomStack<int, std::pmr::polymorphic_allocator<int>> temp_stack(10, polymorphic_allocator);
+        CustomStack<int, std::pmr::polymorphic_allocator<int>, 10> temp_stack(10, polymorphic_allocator);
         CustomStack<int, std::pmr::polymorphic_allocator<int>> large_stack(40, polymorphic_allocator);
         
         for (int element_index = 0; element_index < 10; ++element_index) {
@@ -54,5 +60,18 @@ int main() {
     delete custom_stack4;
     std::cout << "   Все стеки освобождены" << std::endl;
 
+    std::cout << "\n7. Статистика memory_resource:" << std::endl;
+    custom_memory_resource.dump_statistics();
+
+    std::cout << "\n8. Параллельный цикл на планировщике с перехватом задач:" << std::endl;
+    TaskScheduler scheduler(4);
+    std::vector<long long> squares(100000);
+    scheduler.parallel_for(0, squares.size(), 1000, [&squares](std::size_t index) {
+        squares[index] = static_cast<long long>(index) * static_cast<long long>(index);
+    });
+    std::cout << "   Потоков: " << scheduler.worker_count() << std::endl;
+    std::cout << "   Сумма квадратов: " << std::accumulate(squares.begin(), squares.end(), 0LL) << std::endl;
+    std::cout << "   Перехвачено задач: " << scheduler.steal_count() << std::endl;
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,196 @@
+#include "../include/custom_memory_resource.hpp"
+#include "../include/recording_memory_resource.hpp"
+#include "../include/tlsf_memory_resource.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Replays a trace written by RecordingMemoryResource against every candidate resource:
+//   replay TRACE [ARENA_BYTES]
+// ARENA_BYTES caps what a resource may take from its upstream, like a fixed arena would. One CSV
+// row per resource:
+//   subject,events,ns_total,ns_per_event,peak_bytes,failed_at,failed_size
+// peak_bytes is the peak of what the resource requested from its upstream; failed_at is the
+// index of the first event that threw std::bad_alloc, the replay of that resource stops there,
+// or "construction" when the resource could not even be created within the limit.
+
+namespace {
+
+// Upstream of the replayed resources: measures their footprint and fails beyond the limit
+class FootprintResource: public std::pmr::memory_resource {
+
+private:
+
+    std::size_t _limit;
+    std::size_t _bytes_in_use{0};
+    std::size_t _peak_bytes{0};
+
+public:
+
+    explicit FootprintResource(std::size_t limit) :
+        _limit(limit) {
+    }
+
+    std::size_t peak_bytes() const {
+        return _peak_bytes;
+    }
+
+private:
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        if (bytes > _limit - _bytes_in_use) {
+            throw std::bad_alloc();
+        }
+        void* ptr = std::pmr::new_delete_resource()->allocate(bytes, alignment);
+        _bytes_in_use += bytes;
+        _peak_bytes = std::max(_peak_bytes, _bytes_in_use);
+        return ptr;
+    }
+
+    void do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment) override {
+        std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+        _bytes_in_use -= bytes;
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+// A null resource stands for the footprint resource itself, i.e. plain operator new
+struct Subject {
+    std::string name;
+    std::function<std::unique_ptr<std::pmr::memory_resource>(std::pmr::memory_resource*)> make;
+};
+
+struct LiveBlock {
+    void* ptr{nullptr};
+    std::size_t size{0};
+    std::size_t alignment{0};
+};
+
+void replay(const Subject& subject, const std::vector<TraceRecord>& records, std::size_t block_count,
+            std::size_t arena_bytes) {
+    FootprintResource footprint(arena_bytes);
+    std::vector<LiveBlock> live(block_count);
+    std::optional<std::size_t> failed_at;
+    std::unique_ptr<std::pmr::memory_resource> owned;
+    try {
+        owned = subject.make(&footprint);
+    } catch (const std::bad_alloc&) {
+        std::printf("%s,0,0,0,%zu,construction,\n", subject.name.c_str(), footprint.peak_bytes());
+        std::fflush(stdout);
+        return;
+    }
+    std::pmr::memory_resource* memory_resource = owned ? owned.get() : &footprint;
+    auto* expandable = dynamic_cast<ExpandableMemoryResource*>(memory_resource);
+    auto started = std::chrono::steady_clock::now();
+    for (std::size_t index = 0; index < records.size(); ++index) {
+        const TraceRecord& record = records[index];
+        LiveBlock& block = live[record.id];
+        try {
+            switch (record.event) {
+            case TraceEvent::allocate:
+                block.ptr = memory_resource->allocate(record.size, record.alignment);
+                block.size = record.size;
+                block.alignment = record.alignment;
+                break;
+            case TraceEvent::deallocate:
+                if (block.ptr) {
+                    memory_resource->deallocate(block.ptr, block.size, block.alignment);
+                    block = LiveBlock{};
+                }
+                break;
+            case TraceEvent::expand:
+                // Resources that cannot grow the block in place move it instead
+                if (!expandable || !expandable->try_expand(block.ptr, block.size, record.size, block.alignment)) {
+                    void* ptr = memory_resource->allocate(record.size, block.alignment);
+                    memory_resource->deallocate(block.ptr, block.size, block.alignment);
+                    block.ptr = ptr;
+                }
+                block.size = record.size;
+                break;
+            }
+        } catch (const std::bad_alloc&) {
+            failed_at = index;
+            break;
+        }
+    }
+    double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count();
+    for (LiveBlock& block : live) {
+        if (block.ptr) {
+            memory_resource->deallocate(block.ptr, block.size, block.alignment);
+        }
+    }
+    std::size_t replayed = failed_at ? *failed_at : records.size();
+    std::printf("%s,%zu,%.0f,%.3f,%zu,", subject.name.c_str(), replayed, elapsed,
+                elapsed / static_cast<double>(std::max<std::size_t>(replayed, 1)), footprint.peak_bytes());
+    if (failed_at) {
+        std::printf("%zu,%llu\n", *failed_at, static_cast<unsigned long long>(records[*failed_at].size));
+    } else {
+        std::printf("none,\n");
+    }
+    std::fflush(stdout);
+}
+
+std::vector<Subject> subjects() {
+    return {
+        {"CustomMemoryResource/first_fit", [](std::pmr::memory_resource* upstream) {
+            return std::make_unique<CustomMemoryResource>(AllocationMode::first_fit, upstream);
+        }},
+        {"CustomMemoryResource/pool", [](std::pmr::memory_resource* upstream) {
+            return std::make_unique<CustomMemoryResource>(AllocationMode::pool, upstream);
+        }},
+        {"CustomMemoryResource/bitmap", [](std::pmr::memory_resource* upstream) {
+            return std::make_unique<CustomMemoryResource>(AllocationMode::bitmap, upstream, 16);
+        }},
+        {"TlsfMemoryResource", [](std::pmr::memory_resource* upstream) {
+            return std::make_unique<TlsfMemoryResource>(std::size_t{1} << 20, upstream);
+        }},
+        {"unsynchronized_pool_resource", [](std::pmr::memory_resource* upstream) {
+            return std::make_unique<std::pmr::unsynchronized_pool_resource>(upstream);
+        }},
+        {"synchronized_pool_resource", [](std::pmr::memory_resource* upstream) {
+            return std::make_unique<std::pmr::synchronized_pool_resource>(upstream);
+        }},
+        {"monotonic_buffer_resource", [](std::pmr::memory_resource* upstream) {
+            return std::make_unique<std::pmr::monotonic_buffer_resource>(upstream);
+        }},
+        {"new_delete_resource", [](std::pmr::memory_resource* /* upstream */) {
+            return std::unique_ptr<std::pmr::memory_resource>();
+        }},
+    };
+}
+
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 3) {
+        std::fprintf(stderr, "Usage: %s TRACE [ARENA_BYTES]\n", argv[0]);
+        return 2;
+    }
+    try {
+        std::size_t arena_bytes = argc == 3 ? std::stoull(argv[2]) : std::numeric_limits<std::size_t>::max();
+        std::vector<TraceRecord> records = TraceReader(argv[1]).read_all();
+        std::size_t block_count{0};
+        for (const TraceRecord& record : records) {
+            block_count = std::max<std::size_t>(block_count, record.id + 1);
+        }
+        std::printf("subject,events,ns_total,ns_per_event,peak_bytes,failed_at,failed_size\n");
+        for (const Subject& subject : subjects()) {
+            replay(subject, records, block_count, arena_bytes);
+        }
+    } catch (const std::exception& error) {
+        std::fprintf(stderr, "replay: %s\n", error.what());
+        return 1;
+    }
+    return 0;
+}
@@ -1,14 +1,33 @@
 #include <gtest/gtest.h>
 #include "../include/custom_memory_resource.hpp"
 #include "../include/custom_stack.hpp"
+#include "../include/tlsf_memory_resource.hpp"
+#include "../include/concurrent_memory_resource.hpp"
+#include "../include/concurrent_custom_stack.hpp"
+#include "../include/work_stealing_deque.hpp"
+#include "../include/task_scheduler.hpp"
+#include "../include/segmented_custom_stack.hpp"
+#include "../include/mapped_memory_resource.hpp"
+#include "../include/recording_memory_resource.hpp"
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <latch>
+#include <list>
+#include <numeric>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
 
 TEST(AllocatorTest, MemoryTest) {
     CustomMemoryResource custom_memory_resource;
     std::pmr::polymorphic_allocator<char> polymorphic_allocator(&custom_memory_resource);
     char *buffer = polymorphic_allocator.allocate(1024);
-    EXPECT_THROW(polymorphic_allocator.allocate(1), std::bad_alloc);
+    EXPECT_THROW(static_cast<void>(polymorphic_allocator.allocate(1)), std::bad_alloc);
     EXPECT_DEATH(polymorphic_allocator.deallocate(buffer + 1, 1024), ".*");
-    EXPECT_THROW(polymorphic_allocator.allocate(256),std::bad_alloc);
+    EXPECT_THROW(static_cast<void>(polymorphic_allocator.allocate(256)), std::bad_alloc);
     EXPECT_NO_THROW(polymorphic_allocator.deallocate(buffer, 1024));
     EXPECT_NO_THROW(polymorphic_allocator.deallocate(polymorphic_allocator.allocate(256), 256));
 }
@@ -164,4 +183,1358 @@ TEST(StackTest, Iterators) {
         EXPECT_EQ(*it, v[i]);
         ++i;
     }
-}
\ No newline at end of file
+}
+
+TEST(AllocatorTest, PoolModeMemoryTest) {
+    CustomMemoryResource custom_memory_resource(AllocationMode::pool);
+    std::pmr::polymorphic_allocator<char> polymorphic_allocator(&custom_memory_resource);
+    char *buffer = polymorphic_allocator.allocate(1024);
+    EXPECT_THROW(static_cast<void>(polymorphic_allocator.allocate(1)), std::bad_alloc);
+    EXPECT_DEATH(polymorphic_allocator.deallocate(buffer + 1, 1024), ".*");
+    EXPECT_THROW(static_cast<void>(polymorphic_allocator.allocate(256)), std::bad_alloc);
+    EXPECT_NO_THROW(polymorphic_allocator.deallocate(buffer, 1024));
+    EXPECT_NO_THROW(polymorphic_allocator.deallocate(polymorphic_allocator.allocate(256), 256));
+}
+
+TEST(AllocatorTest, PoolModeReusesBlocks) {
+    CustomMemoryResource custom_memory_resource(AllocationMode::pool);
+    std::pmr::polymorphic_allocator<int> polymorphic_allocator(&custom_memory_resource);
+    int *first = polymorphic_allocator.allocate(3);
+    int *second = polymorphic_allocator.allocate(4);
+    EXPECT_NE(first, second);
+    polymorphic_allocator.deallocate(first, 3);
+    EXPECT_EQ(polymorphic_allocator.allocate(4), first);
+    EXPECT_DEATH(polymorphic_allocator.deallocate(second + 1, 4), ".*");
+    EXPECT_DEATH(polymorphic_allocator.deallocate(second, 16), ".*");
+    std::vector<int*> blocks;
+    for (int i{0}; i < 40; ++i) {
+        blocks.push_back(polymorphic_allocator.allocate(2));
+    }
+    for (int *block : blocks) {
+        EXPECT_NO_THROW(polymorphic_allocator.deallocate(block, 2));
+    }
+}
+
+TEST(StackTest, PoolModeMemoryTest) {
+    CustomMemoryResource custom_memory_resource(AllocationMode::pool);
+    std::pmr::polymorphic_allocator<int> polymorphic_allocator(&custom_memory_resource);
+    EXPECT_NO_THROW((CustomStack<int, std::pmr::polymorphic_allocator<int>>(0, polymorphic_allocator)));
+    EXPECT_NO_THROW((CustomStack<int, std::pmr::polymorphic_allocator<int>>(10, polymorphic_allocator)));
+    EXPECT_NO_THROW((CustomStack<int, std::pmr::polymorphic_allocator<int>>(custom_memory_resource._get_buffer_size() / sizeof(int), polymorphic_allocator)));
+    EXPECT_ANY_THROW((CustomStack<int, std::pmr::polymorphic_allocator<int>>(custom_memory_resource._get_buffer_size() / sizeof(int) + 1, polymorphic_allocator)));
+
+    CustomStack<int, std::pmr::polymorphic_allocator<int>> stack(1, polymorphic_allocator);
+    for (int i{0}; i < 64; ++i) {
+        stack.push(i);
+    }
+    EXPECT_EQ(stack.size(), 64);
+    EXPECT_EQ(stack.top(), 63);
+}
+
+TEST(TlsfAllocatorTest, MemoryTest) {
+    TlsfMemoryResource tlsf_memory_resource(1024);
+    std::pmr::polymorphic_allocator<char> polymorphic_allocator(&tlsf_memory_resource);
+    char *buffer = polymorphic_allocator.allocate(512);
+    EXPECT_THROW(static_cast<void>(polymorphic_allocator.allocate(1024)), std::bad_alloc);
+    EXPECT_DEATH(polymorphic_allocator.deallocate(buffer + 1, 512), ".*");
+    EXPECT_DEATH(polymorphic_allocator.deallocate(buffer, 1024), ".*");
+    EXPECT_NO_THROW(polymorphic_allocator.deallocate(buffer, 512));
+    EXPECT_DEATH(polymorphic_allocator.deallocate(buffer, 512), ".*");
+}
+
+TEST(TlsfAllocatorTest, RejectsBadRequests) {
+    TlsfMemoryResource tlsf_memory_resource(1 << 20);
+    EXPECT_THROW(static_cast<void>(tlsf_memory_resource.allocate(std::numeric_limits<std::size_t>::max() - 4, 8)), std::bad_alloc);
+    EXPECT_THROW(static_cast<void>(tlsf_memory_resource.allocate(std::numeric_limits<std::size_t>::max())), std::bad_alloc);
+    char *buffer = static_cast<char*>(tlsf_memory_resource.allocate(512));
+    for (unsigned char pattern : {0x00, 0x20, 0xFF}) {
+        std::memset(buffer, pattern, 512);
+        EXPECT_THROW(tlsf_memory_resource.deallocate(buffer + 256, 16), std::logic_error);
+    }
+    // A forged header that matches the block in front of it but not the one behind
+    reinterpret_cast<std::size_t*>(buffer + 240)[0] = 256;
+    reinterpret_cast<std::size_t*>(buffer + 240)[1] = 256;
+    EXPECT_THROW(tlsf_memory_resource.deallocate(buffer + 256, 16), std::logic_error);
+    EXPECT_THROW(tlsf_memory_resource.deallocate(buffer, std::numeric_limits<std::size_t>::max()), std::logic_error);
+    EXPECT_FALSE(tlsf_memory_resource.try_expand(buffer, 512, std::numeric_limits<std::size_t>::max()));
+    tlsf_memory_resource.deallocate(buffer, 512);
+    void *whole = nullptr;
+    EXPECT_NO_THROW(whole = tlsf_memory_resource.allocate(1 << 19));
+    tlsf_memory_resource.deallocate(whole, 1 << 19);
+}
+
+TEST(TlsfAllocatorTest, CoalescesNeighbours) {
+    TlsfMemoryResource tlsf_memory_resource(4096);
+    std::pmr::polymorphic_allocator<char> polymorphic_allocator(&tlsf_memory_resource);
+    std::vector<char*> blocks;
+    for (std::size_t size{1}; size < 400; size += 37) {
+        blocks.push_back(polymorphic_allocator.allocate(size));
+    }
+    for (std::size_t i{0}; i < blocks.size(); i += 2) {
+        polymorphic_allocator.deallocate(blocks[i], 1 + 37 * i);
+    }
+    for (std::size_t i{1}; i < blocks.size(); i += 2) {
+        polymorphic_allocator.deallocate(blocks[i], 1 + 37 * i);
+    }
+    char *whole = nullptr;
+    EXPECT_NO_THROW(whole = polymorphic_allocator.allocate(3584));
+    EXPECT_NO_THROW(polymorphic_allocator.deallocate(whole, 3584));
+}
+
+TEST(TlsfAllocatorTest, AlignedAllocation) {
+    TlsfMemoryResource tlsf_memory_resource(4096);
+    std::pmr::memory_resource& memory_resource = tlsf_memory_resource;
+    void *small = memory_resource.allocate(24, 8);
+    void *aligned = memory_resource.allocate(100, 256);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(aligned) % 256, 0);
+    memory_resource.deallocate(small, 24, 8);
+    memory_resource.deallocate(aligned, 100, 256);
+    void *whole = nullptr;
+    EXPECT_NO_THROW(whole = memory_resource.allocate(3500));
+    memory_resource.deallocate(whole, 3500);
+}
+
+TEST(StackTest, TlsfResource) {
+    TlsfMemoryResource tlsf_memory_resource(16384);
+    std::pmr::polymorphic_allocator<int> polymorphic_allocator(&tlsf_memory_resource);
+    CustomStack<int, std::pmr::polymorphic_allocator<int>> stack(1, polymorphic_allocator);
+    for (int i{0}; i < 1000; ++i) {
+        stack.push(i);
+    }
+    EXPECT_EQ(stack.size(), 1000);
+    EXPECT_EQ(stack.top(), 999);
+}
+
+TEST(StackTest, TlsfShrinkReturnsMemory) {
+    TlsfMemoryResource tlsf_memory_resource(65536);
+    std::pmr::polymorphic_allocator<int> polymorphic_allocator(&tlsf_memory_resource);
+    CustomStack<int, std::pmr::polymorphic_allocator<int>> stack(1, polymorphic_allocator);
+    stack.reserve(12000);
+    for (int i{0}; i < 12000; ++i) {
+        stack.push(i);
+    }
+    stack.pop_n(11999);
+    stack.shrink_to_fit();
+    EXPECT_EQ(stack.capacity(), 1);
+    EXPECT_EQ(stack.top(), 0);
+    void* block{nullptr};
+    EXPECT_NO_THROW(block = tlsf_memory_resource.allocate(30000));
+    tlsf_memory_resource.deallocate(block, 30000);
+}
+
+TEST(AllocatorTest, ConfigurableBufferSize) {
+    BasicCustomMemoryResource<4096> custom_memory_resource;
+    std::pmr::polymorphic_allocator<char> polymorphic_allocator(&custom_memory_resource);
+    EXPECT_EQ(custom_memory_resource._get_buffer_size(), 4096);
+    char *buffer = polymorphic_allocator.allocate(4096);
+    EXPECT_THROW(static_cast<void>(polymorphic_allocator.allocate(1)), std::bad_alloc);
+    EXPECT_NO_THROW(polymorphic_allocator.deallocate(buffer, 4096));
+}
+
+TEST(AllocatorTest, GrowsFromUpstream) {
+    for (AllocationMode mode : {AllocationMode::first_fit, AllocationMode::pool}) {
+        CustomMemoryResource custom_memory_resource(mode, std::pmr::new_delete_resource());
+        std::pmr::polymorphic_allocator<char> polymorphic_allocator(&custom_memory_resource);
+        char *buffer = polymorphic_allocator.allocate(1024);
+        EXPECT_EQ(custom_memory_resource.chunk_count(), 1);
+        char *extra = nullptr;
+        EXPECT_NO_THROW(extra = polymorphic_allocator.allocate(100));
+        EXPECT_EQ(custom_memory_resource.chunk_count(), 2);
+        EXPECT_GE(custom_memory_resource.capacity(), 3 * 1024);
+        char *large = nullptr;
+        EXPECT_NO_THROW(large = polymorphic_allocator.allocate(10000));
+        EXPECT_EQ(custom_memory_resource.chunk_count(), 3);
+        polymorphic_allocator.deallocate(large, 10000);
+        polymorphic_allocator.deallocate(extra, 100);
+        polymorphic_allocator.deallocate(buffer, 1024);
+    }
+}
+
+TEST(StackTest, GrowableResource) {
+    CustomMemoryResource custom_memory_resource(AllocationMode::first_fit, std::pmr::new_delete_resource());
+    std::pmr::polymorphic_allocator<int> polymorphic_allocator(&custom_memory_resource);
+    CustomStack<int, std::pmr::polymorphic_allocator<int>> stack(1, polymorphic_allocator);
+    for (int i{0}; i < 10000; ++i) {
+        stack.push(i);
+    }
+    EXPECT_EQ(stack.size(), 10000);
+    EXPECT_EQ(stack.top(), 9999);
+}
+
+TEST(ConcurrentAllocatorTest, ThreadCachesReturnBlocks) {
+    ConcurrentCustomMemoryResource<> concurrent_memory_resource;
+    std::pmr::polymorphic_allocator<int> polymorphic_allocator(&concurrent_memory_resource);
+    int *value = polymorphic_allocator.allocate(1);
+    *value = 42;
+    std::thread([&] {
+        polymorphic_allocator.deallocate(value, 1);
+        int *other = polymorphic_allocator.allocate(1);
+        polymorphic_allocator.deallocate(other, 1);
+    }).join();
+    concurrent_memory_resource.flush_thread_cache();
+    std::pmr::polymorphic_allocator<char> arena_allocator(&concurrent_memory_resource.arena());
+    char *whole = nullptr;
+    EXPECT_NO_THROW(whole = arena_allocator.allocate(1024));
+    arena_allocator.deallocate(whole, 1024);
+}
+
+// Every thread keeps a window of live blocks tagged with its index. Before freeing their last
+// windows the threads wait until it is checked that no block is held by two of them
+template<typename Resource>
+void stress_memory_resource(Resource& memory_resource, std::size_t thread_count, std::size_t iterations) {
+    constexpr std::size_t WINDOW{16};
+    std::atomic<std::size_t> corrupted{0};
+    std::vector<std::array<std::size_t*, WINDOW>> windows(thread_count);
+    std::latch filled(static_cast<std::ptrdiff_t>(thread_count));
+    std::latch checked(1);
+    std::vector<std::thread> threads;
+    for (std::size_t thread_index = 0; thread_index < thread_count; ++thread_index) {
+        threads.emplace_back([&, thread_index] {
+            std::pmr::polymorphic_allocator<std::size_t> polymorphic_allocator(&memory_resource);
+            std::array<std::size_t*, WINDOW>& live = windows[thread_index];
+            for (std::size_t i{0}; i < iterations; ++i) {
+                std::size_t slot = i % live.size();
+                if (live[slot]) {
+                    if (*live[slot] != thread_index) {
+                        ++corrupted;
+                    }
+                    polymorphic_allocator.deallocate(live[slot], 1 + slot % 8);
+                }
+                live[slot] = polymorphic_allocator.allocate(1 + slot % 8);
+                *live[slot] = thread_index;
+            }
+            filled.count_down();
+            checked.wait();
+            for (std::size_t slot{0}; slot < live.size(); ++slot) {
+                polymorphic_allocator.deallocate(live[slot], 1 + slot % 8);
+            }
+        });
+    }
+    filled.wait();
+    std::vector<std::size_t*> blocks;
+    for (const std::array<std::size_t*, WINDOW>& live : windows) {
+        blocks.insert(blocks.end(), live.begin(), live.end());
+    }
+    std::sort(blocks.begin(), blocks.end());
+    EXPECT_EQ(std::adjacent_find(blocks.begin(), blocks.end()), blocks.end());
+    checked.count_down();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(corrupted, 0);
+}
+
+TEST(ConcurrentAllocatorTest, StressReturnsAllBlocks) {
+    std::size_t max_threads = std::max(2u, std::min(8u, std::thread::hardware_concurrency()));
+    for (std::size_t thread_count{1}; thread_count <= max_threads; thread_count *= 2) {
+        CustomMemoryResource custom_memory_resource(AllocationMode::pool, std::pmr::new_delete_resource());
+        stress_memory_resource(custom_memory_resource, thread_count, 50000);
+        EXPECT_EQ(custom_memory_resource.statistics().bytes_in_use, 0);
+        // The caches of finished threads go back to the arena on thread exit
+        ConcurrentCustomMemoryResource<> concurrent_memory_resource(AllocationMode::pool, std::pmr::new_delete_resource());
+        stress_memory_resource(concurrent_memory_resource, thread_count, 50000);
+        EXPECT_EQ(concurrent_memory_resource.arena().statistics().bytes_in_use, 0);
+    }
+}
+
+struct CountingItem {
+    static inline int constructed{0};
+    static inline int destroyed{0};
+    int value;
+
+    explicit CountingItem(int v) : value(v) {
+        ++constructed;
+    }
+    CountingItem(const CountingItem& other) : value(other.value) {
+        ++constructed;
+    }
+    CountingItem(CountingItem&& other) noexcept : value(other.value) {
+        ++constructed;
+    }
+    ~CountingItem() {
+        ++destroyed;
+    }
+};
+
+TEST(StackTest, LazyConstruction) {
+    CountingItem::constructed = 0;
+    CountingItem::destroyed = 0;
+    CustomMemoryResource custom_memory_resource(AllocationMode::first_fit, std::pmr::new_delete_resource());
+    {
+        std::pmr::polymorphic_allocator<CountingItem> polymorphic_allocator(&custom_memory_resource);
+        CustomStack<CountingItem, std::pmr::polymorphic_allocator<CountingItem>> stack(1000, polymorphic_allocator);
+        EXPECT_EQ(CountingItem::constructed, 0);
+        EXPECT_EQ(stack.emplace(7).value, 7);
+        stack.emplace(8);
+        EXPECT_EQ(CountingItem::constructed, 2);
+        stack.pop();
+        EXPECT_EQ(CountingItem::destroyed, 1);
+        EXPECT_EQ(stack.top().value, 7);
+    }
+    EXPECT_EQ(CountingItem::constructed, CountingItem::destroyed);
+}
+
+TEST(StackTest, PushOwnElementWhileGrowing) {
+    CustomMemoryResource custom_memory_resource;
+    std::pmr::polymorphic_allocator<std::pmr::string> polymorphic_allocator(&custom_memory_resource);
+    CustomStack<std::pmr::string, std::pmr::polymorphic_allocator<std::pmr::string>> stack(1, polymorphic_allocator);
+    stack.emplace("element");
+    for (int i{0}; i < 5; ++i) {
+        stack.push(stack.top());
+    }
+    EXPECT_EQ(stack.size(), 6);
+    for (const auto& item : stack) {
+        EXPECT_EQ(item, "element");
+    }
+}
+
+TEST(AllocatorTest, TryExpand) {
+    CustomMemoryResource custom_memory_resource;
+    void *first = custom_memory_resource.allocate(100);
+    void *second = custom_memory_resource.allocate(100, 1);
+    EXPECT_FALSE(custom_memory_resource.try_expand(first, 100, 101));
+    EXPECT_TRUE(custom_memory_resource.try_expand(second, 100, 900, 1));
+    EXPECT_FALSE(custom_memory_resource.try_expand(second, 900, 1000, 1));
+    custom_memory_resource.deallocate(second, 900, 1);
+    EXPECT_TRUE(custom_memory_resource.try_expand(first, 100, 1024));
+    custom_memory_resource.deallocate(first, 1024);
+
+    CustomMemoryResource pool_memory_resource(AllocationMode::pool);
+    void *pooled = pool_memory_resource.allocate(20, 4);
+    EXPECT_TRUE(pool_memory_resource.try_expand(pooled, 20, 32, 4));
+    EXPECT_FALSE(pool_memory_resource.try_expand(pooled, 32, 33, 4));
+    pool_memory_resource.deallocate(pooled, 32, 4);
+}
+
+TEST(TlsfAllocatorTest, TryExpand) {
+    TlsfMemoryResource tlsf_memory_resource(4096);
+    void *first = tlsf_memory_resource.allocate(100);
+    void *second = tlsf_memory_resource.allocate(100);
+    EXPECT_FALSE(tlsf_memory_resource.try_expand(first, 100, 200));
+    EXPECT_TRUE(tlsf_memory_resource.try_expand(second, 100, 2000));
+    tlsf_memory_resource.deallocate(second, 2000);
+    EXPECT_TRUE(tlsf_memory_resource.try_expand(first, 100, 3000));
+    tlsf_memory_resource.deallocate(first, 3000);
+}
+
+TEST(StackTest, GrowsInPlace) {
+    CustomMemoryResource custom_memory_resource(AllocationMode::first_fit, std::pmr::new_delete_resource());
+    std::pmr::polymorphic_allocator<int> polymorphic_allocator(&custom_memory_resource);
+    CustomStack<int, std::pmr::polymorphic_allocator<int>> stack(1, polymorphic_allocator);
+    stack.push(0);
+    const int *bottom = &*stack.begin();
+    for (int i{1}; i < 128; ++i) {
+        stack.push(i);
+    }
+    EXPECT_EQ(&*stack.begin(), bottom);
+
+    CustomStack<int, std::pmr::polymorphic_allocator<int>> blocker(1, polymorphic_allocator);
+    stack.push(128);
+    EXPECT_NE(&*stack.begin(), bottom);
+    int i{0};
+    for (int item : stack) {
+        EXPECT_EQ(item, i++);
+    }
+}
+
+TEST(StackTest, BulkOperations) {
+    CustomMemoryResource custom_memory_resource(AllocationMode::first_fit, std::pmr::new_delete_resource());
+    std::pmr::polymorphic_allocator<int> polymorphic_allocator(&custom_memory_resource);
+    CustomStack<int, std::pmr::polymorphic_allocator<int>> stack(1, polymorphic_allocator);
+    stack.reserve(100);
+    EXPECT_EQ(stack.capacity(), 100);
+    std::vector<int> v(300);
+    std::iota(v.begin(), v.end(), 0);
+    stack.push_range(std::span<const int>(v));
+    EXPECT_EQ(stack.size(), 300);
+    EXPECT_EQ(stack.top(), 299);
+    std::list<int> l{1000, 1001};
+    stack.push_range(l.begin(), l.end());
+    EXPECT_EQ(stack.top(), 1001);
+    stack.pop_n(2);
+    EXPECT_EQ(stack.top(), 299);
+    stack.pop_n(250);
+    EXPECT_EQ(stack.size(), 50);
+    EXPECT_EQ(stack.top(), 49);
+    EXPECT_THROW(stack.pop_n(51), std::out_of_range);
+
+    CustomStack<std::pmr::string, std::pmr::polymorphic_allocator<std::pmr::string>> strings(1, &custom_memory_resource);
+    std::vector<std::string> words{"a", "b", "c"};
+    strings.push_range(words.begin(), words.end());
+    EXPECT_EQ(strings.size(), 3);
+    EXPECT_EQ(strings.top(), "c");
+    strings.pop_n(3);
+    EXPECT_TRUE(strings.empty());
+}
+
+TEST(StackTest, MoveOperatorStealsStorage) {
+    CustomMemoryResource custom_memory_resource;
+    std::pmr::polymorphic_allocator<int> polymorphic_allocator(&custom_memory_resource);
+    CustomStack<int, std::pmr::polymorphic_allocator<int>> stack(20, polymorphic_allocator);
+    stack.push(1);
+    stack.push(2);
+    const int *storage = &*stack.begin();
+    CustomStack<int, std::pmr::polymorphic_allocator<int>> move(200, polymorphic_allocator);
+    move = std::move(stack);
+    EXPECT_EQ(&*move.begin(), storage);
+    EXPECT_EQ(move.capacity(), 20);
+    EXPECT_EQ(move.top(), 2);
+    EXPECT_TRUE(stack.empty());
+    stack.push(3);
+    EXPECT_EQ(stack.top(), 3);
+
+    CustomMemoryResource other_memory_resource;
+    CustomStack<int, std::pmr::polymorphic_allocator<int>> other(1, &other_memory_resource);
+    other = std::move(move);
+    EXPECT_EQ(other.size(), 2);
+    EXPECT_EQ(other.top(), 2);
+    EXPECT_NE(&*other.begin(), storage);
+    EXPECT_TRUE(move.empty());
+}
+
+TEST(StackTest, CopyOnlyLiveElements) {
+    CountingItem::constructed = 0;
+    CountingItem::destroyed = 0;
+    CustomMemoryResource custom_memory_resource;
+    {
+        std::pmr::polymorphic_allocator<CountingItem> polymorphic_allocator(&custom_memory_resource);
+        CustomStack<CountingItem, std::pmr::polymorphic_allocator<CountingItem>> stack(50, polymorphic_allocator);
+        stack.emplace(1);
+        stack.emplace(2);
+        CustomStack<CountingItem, std::pmr::polymorphic_allocator<CountingItem>> copy(stack, polymorphic_allocator);
+        EXPECT_EQ(copy.capacity(), 2);
+        EXPECT_EQ(CountingItem::constructed, 4);
+        CustomStack<CountingItem, std::pmr::polymorphic_allocator<CountingItem>> assigned(10, polymorphic_allocator);
+        assigned = stack;
+        EXPECT_EQ(assigned.capacity(), 10);
+        EXPECT_EQ(assigned.top().value, 2);
+        EXPECT_EQ(CountingItem::constructed, 6);
+    }
+    EXPECT_EQ(CountingItem::constructed, CountingItem::destroyed);
+}
+
+TEST(StackTest, ShrinkToFit) {
+    CustomMemoryResource custom_memory_resource;
+    std::pmr::polymorphic_allocator<int> polymorphic_allocator(&custom_memory_resource);
+    CustomStack<int, std::pmr::polymorphic_allocator<int>> stack(200, polymorphic_allocator);
+    for (int i{0}; i < 10; ++i) {
+        stack.push(i);
+    }
+    EXPECT_THROW(static_cast<void>(custom_memory_resource.allocate(700)), std::bad_alloc);
+    stack.shrink_to_fit();
+    EXPECT_EQ(stack.capacity(), 10);
+    EXPECT_EQ(stack.top(), 9);
+    void *large = nullptr;
+    EXPECT_NO_THROW(large = custom_memory_resource.allocate(700));
+    custom_memory_resource.deallocate(large, 700);
+    stack.pop_n(10);
+    stack.shrink_to_fit();
+    EXPECT_EQ(stack.capacity(), 0);
+    stack.push(1);
+    EXPECT_EQ(stack.top(), 1);
+}
+
+TEST(StackTest, ContiguousIterators) {
+    using Stack = CustomStack<int, std::pmr::polymorphic_allocator<int>>;
+    static_assert(std::contiguous_iterator<Stack::iterator>);
+    static_assert(std::contiguous_iterator<Stack::const_iterator>);
+    static_assert(std::ranges::contiguous_range<Stack>);
+
+    CustomMemoryResource custom_memory_resource;
+    Stack stack(10, &custom_memory_resource);
+    std::vector<int> v = {5, 3, 9, 1, 7};
+    stack.push_range(std::span<const int>(v));
+
+    EXPECT_EQ(stack.end() - stack.begin(), 5);
+    EXPECT_EQ(stack.begin()[2], 9);
+    EXPECT_EQ(*(stack.end() - 1), stack.top());
+    EXPECT_EQ(stack.data(), stack.as_span().data());
+    EXPECT_EQ(std::accumulate(stack.as_span().begin(), stack.as_span().end(), 0), 25);
+
+    std::vector<int> top_to_bottom(stack.rbegin(), stack.rend());
+    EXPECT_EQ(top_to_bottom, (std::vector<int>{7, 1, 9, 3, 5}));
+
+    for (int& item : stack) {
+        item *= 2;
+    }
+    std::ranges::sort(stack);
+    EXPECT_TRUE(std::ranges::equal(stack, std::vector<int>{2, 6, 10, 14, 18}));
+    Stack::const_iterator const_begin = stack.begin();
+    EXPECT_EQ(*const_begin, 2);
+#ifndef NDEBUG
+    EXPECT_THROW(*stack.end(), std::out_of_range);
+#endif
+}
+
+TEST(AllocatorTest, Statistics) {
+    CustomMemoryResource custom_memory_resource;
+    void *first = custom_memory_resource.allocate(100);
+    void *second = custom_memory_resource.allocate(200);
+    void *third = custom_memory_resource.allocate(300);
+    EXPECT_THROW(static_cast<void>(custom_memory_resource.allocate(1000)), std::bad_alloc);
+    custom_memory_resource.deallocate(second, 200);
+
+    MemoryResourceStatistics statistics = custom_memory_resource.statistics();
+    EXPECT_TRUE(statistics.counters_enabled);
+    EXPECT_EQ(statistics.allocations, 3);
+    EXPECT_EQ(statistics.deallocations, 1);
+    EXPECT_EQ(statistics.failed_allocations, 1);
+    EXPECT_EQ(statistics.bytes_in_use, 400);
+    EXPECT_EQ(statistics.peak_bytes_in_use, 600);
+    EXPECT_EQ(statistics.size_histogram[MemoryResourceStatistics::histogram_bucket(100)], 1);
+    EXPECT_EQ(statistics.size_histogram[MemoryResourceStatistics::histogram_bucket(200)], 1);
+    EXPECT_EQ(statistics.size_histogram[MemoryResourceStatistics::histogram_bucket(300)], 1);
+    EXPECT_EQ(statistics.capacity, 1024);
+    EXPECT_EQ(statistics.free_bytes, 624);
+    EXPECT_EQ(statistics.largest_free_gap, 404);
+    EXPECT_NEAR(statistics.external_fragmentation, 1.0 - 404.0 / 624.0, 1e-9);
+
+    std::ostringstream dump;
+    custom_memory_resource.dump_statistics(dump);
+    EXPECT_NE(dump.str().find("peak bytes in use:      600"), std::string::npos);
+    custom_memory_resource.deallocate(first, 100);
+    custom_memory_resource.deallocate(third, 300);
+    EXPECT_EQ(custom_memory_resource.statistics().bytes_in_use, 0);
+}
+
+TEST(ConcurrentStackTest, SingleThread) {
+    CustomMemoryResource custom_memory_resource(AllocationMode::pool, std::pmr::new_delete_resource());
+    ConcurrentCustomStack<std::pmr::string, std::pmr::polymorphic_allocator<std::pmr::string>> stack(&custom_memory_resource);
+    EXPECT_TRUE(stack.empty());
+    EXPECT_FALSE(stack.try_pop().has_value());
+    EXPECT_THROW(stack.pop(), std::out_of_range);
+    stack.push("first");
+    stack.emplace(3, 'x');
+    EXPECT_FALSE(stack.empty());
+    EXPECT_EQ(stack.try_pop(), "xxx");
+    stack.push("second");
+    EXPECT_EQ(stack.try_pop(), "second");
+    EXPECT_EQ(stack.try_pop(), "first");
+    EXPECT_TRUE(stack.empty());
+    for (int i{0}; i < 1000; ++i) {
+        stack.emplace(std::to_string(i));
+    }
+}
+
+TEST(ConcurrentStackTest, FailedSegmentAllocation) {
+    BasicCustomMemoryResource<2048> memory_resource;
+    ConcurrentCustomStack<std::uint64_t, std::pmr::polymorphic_allocator<std::uint64_t>> stack(&memory_resource);
+    for (std::uint64_t i{0}; i < 64; ++i) {
+        stack.push(i);
+    }
+    EXPECT_THROW(stack.push(64), std::bad_alloc);
+    EXPECT_THROW(stack.push(64), std::bad_alloc);
+    EXPECT_EQ(stack.try_pop(), 63);
+    stack.push(100);
+    EXPECT_EQ(stack.try_pop(), 100);
+    std::uint64_t count{0};
+    while (stack.try_pop()) {
+        ++count;
+    }
+    EXPECT_EQ(count, 63);
+}
+
+TEST(ConcurrentStackTest, SegmentAllocatedOnce) {
+    BasicCustomMemoryResource<4096> memory_resource;
+    ConcurrentCustomStack<std::uint64_t, std::pmr::polymorphic_allocator<std::uint64_t>> stack(&memory_resource);
+    for (std::uint64_t i{0}; i < 64; ++i) {
+        stack.push(i);
+    }
+    constexpr std::size_t THREADS{4};
+    std::latch start(THREADS);
+    std::atomic<std::size_t> failures{0};
+    std::vector<std::thread> threads;
+    for (std::size_t thread_index{0}; thread_index < THREADS; ++thread_index) {
+        threads.emplace_back([&, thread_index] {
+            start.arrive_and_wait();
+            try {
+                stack.push(64 + thread_index);
+            } catch (const std::bad_alloc&) {
+                ++failures;
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(failures.load(), 0);
+    std::uint64_t count{0};
+    while (stack.try_pop()) {
+        ++count;
+    }
+    EXPECT_EQ(count, 64 + THREADS);
+}
+
+TEST(ConcurrentStackTest, ProducersAndConsumers) {
+    CustomMemoryResource custom_memory_resource(AllocationMode::pool, std::pmr::new_delete_resource());
+    ConcurrentCustomStack<std::uint64_t, std::pmr::polymorphic_allocator<std::uint64_t>> stack(&custom_memory_resource);
+    constexpr std::uint64_t ITEMS_PER_PRODUCER{20000};
+    constexpr std::size_t PRODUCERS{4};
+    std::atomic<std::uint64_t> popped_sum{0};
+    std::atomic<std::uint64_t> popped_count{0};
+    std::vector<std::thread> threads;
+    for (std::size_t producer{0}; producer < PRODUCERS; ++producer) {
+        threads.emplace_back([&stack, producer] {
+            for (std::uint64_t i{1}; i <= ITEMS_PER_PRODUCER; ++i) {
+                stack.push(producer * ITEMS_PER_PRODUCER + i);
+            }
+        });
+        threads.emplace_back([&] {
+            while (popped_count.load() < PRODUCERS * ITEMS_PER_PRODUCER) {
+                if (std::optional<std::uint64_t> item = stack.try_pop()) {
+                    popped_sum += *item;
+                    ++popped_count;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    std::uint64_t total = PRODUCERS * ITEMS_PER_PRODUCER;
+    EXPECT_EQ(popped_count.load(), total);
+    EXPECT_EQ(popped_sum.load(), total * (total + 1) / 2);
+    EXPECT_TRUE(stack.empty());
+}
+
+TEST(WorkStealingDequeTest, OwnerAndThiefEnds) {
+    CustomMemoryResource custom_memory_resource(AllocationMode::first_fit, std::pmr::new_delete_resource());
+    WorkStealingDeque<int, std::pmr::polymorphic_allocator<int>> deque(2, &custom_memory_resource);
+    EXPECT_FALSE(deque.pop().has_value());
+    EXPECT_FALSE(deque.steal().has_value());
+    for (int i{0}; i < 10; ++i) {
+        deque.push(i);
+    }
+    EXPECT_EQ(deque.size(), 10);
+    EXPECT_GE(deque.capacity(), 10);
+    EXPECT_EQ(deque.pop(), 9);
+    EXPECT_EQ(deque.steal(), 0);
+    EXPECT_EQ(deque.steal(), 1);
+    EXPECT_EQ(deque.pop(), 8);
+    EXPECT_EQ(deque.size(), 6);
+    while (deque.pop()) {
+    }
+    EXPECT_TRUE(deque.empty());
+}
+
+TEST(WorkStealingDequeTest, EveryItemTakenOnce) {
+    WorkStealingDeque<std::uint64_t, std::pmr::polymorphic_allocator<std::uint64_t>> deque(4);
+    constexpr std::uint64_t ITEMS{100000};
+    constexpr std::size_t THIEVES{3};
+    std::atomic<std::uint64_t> taken_sum{0};
+    std::atomic<std::uint64_t> taken_count{0};
+    std::vector<std::thread> thieves;
+    for (std::size_t thief{0}; thief < THIEVES; ++thief) {
+        thieves.emplace_back([&] {
+            while (taken_count.load() < ITEMS) {
+                if (std::optional<std::uint64_t> item = deque.steal()) {
+                    taken_sum += *item;
+                    ++taken_count;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (std::uint64_t i{1}; i <= ITEMS; ++i) {
+        deque.push(i);
+        if (i % 3 == 0) {
+            if (std::optional<std::uint64_t> item = deque.pop()) {
+                taken_sum += *item;
+                ++taken_count;
+            }
+        }
+    }
+    while (taken_count.load() < ITEMS) {
+        if (std::optional<std::uint64_t> item = deque.pop()) {
+            taken_sum += *item;
+            ++taken_count;
+        }
+    }
+    for (std::thread& thief : thieves) {
+        thief.join();
+    }
+    EXPECT_EQ(taken_count.load(), ITEMS);
+    EXPECT_EQ(taken_sum.load(), ITEMS * (ITEMS + 1) / 2);
+}
+
+TEST(TaskSchedulerTest, ParallelFor) {
+    TaskScheduler scheduler(4);
+    EXPECT_EQ(scheduler.worker_count(), 4);
+    std::vector<std::atomic<int>> visits(10000);
+    scheduler.parallel_for(0, visits.size(), 64, [&visits](std::size_t index) {
+        ++visits[index];
+    });
+    for (const std::atomic<int>& count : visits) {
+        EXPECT_EQ(count.load(), 1);
+    }
+    std::atomic<std::uint64_t> sum{0};
+    scheduler.parallel_for(0, 100, 1, [&](std::size_t outer) {
+        scheduler.parallel_for(0, 100, 8, [&](std::size_t inner) {
+            sum += outer * 100 + inner;
+        });
+    });
+    EXPECT_EQ(sum.load(), 9999ull * 10000 / 2);
+}
+
+TEST(TaskSchedulerTest, RecursiveSpawnAndExceptions) {
+    TaskScheduler scheduler(3);
+    std::function<std::uint64_t(std::uint64_t)> fibonacci = [&](std::uint64_t n) -> std::uint64_t {
+        if (n < 2) {
+            return n;
+        }
+        std::uint64_t left{0};
+        TaskGroup group;
+        scheduler.spawn(group, [&] { left = fibonacci(n - 1); });
+        std::uint64_t right = fibonacci(n - 2);
+        scheduler.wait(group);
+        return left + right;
+    };
+    TaskGroup root;
+    std::uint64_t result{0};
+    scheduler.spawn(root, [&] { result = fibonacci(20); });
+    scheduler.wait(root);
+    EXPECT_EQ(result, 6765);
+
+    EXPECT_THROW(scheduler.parallel_for(0, 100, 10, [](std::size_t index) {
+        if (index == 57) {
+            throw std::runtime_error("task failed");
+        }
+    }), std::runtime_error);
+}
+
+TEST(TaskSchedulerTest, DestroysQueuedTasks) {
+    CustomMemoryResource custom_memory_resource(AllocationMode::first_fit, std::pmr::new_delete_resource());
+    TaskGroup group;
+    std::atomic<bool> started{false};
+    std::atomic<bool> released{false};
+    std::atomic<int> runs{0};
+    std::thread releaser;
+    {
+        TaskScheduler scheduler(1, &custom_memory_resource);
+        scheduler.spawn(group, [&] {
+            started = true;
+            while (!released) {
+                std::this_thread::yield();
+            }
+        });
+        while (!started) {
+            std::this_thread::yield();
+        }
+        for (int task_index{0}; task_index < 100; ++task_index) {
+            scheduler.spawn(group, [&runs] { ++runs; });
+        }
+        releaser = std::thread([&released] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            released = true;
+        });
+    }
+    releaser.join();
+    EXPECT_LT(runs.load(), 100);
+    EXPECT_EQ(custom_memory_resource.statistics().bytes_in_use, 0);
+}
+
+TEST(StackTest, InlineCapacity) {
+    CustomMemoryResource custom_memory_resource;
+    std::pmr::polymorphic_allocator<int> polymorphic_allocator(&custom_memory_resource);
+    CustomStack<int, std::pmr::polymorphic_allocator<int>, 4> stack(polymorphic_allocator);
+    EXPECT_EQ(stack.capacity(), 4);
+    for (int i{0}; i < 4; ++i) {
+        stack.push(i);
+    }
+    EXPECT_EQ(custom_memory_resource.statistics().allocations, 0);
+    EXPECT_GE(reinterpret_cast<const char*>(stack.data()), reinterpret_cast<const char*>(&stack));
+    EXPECT_LT(reinterpret_cast<const char*>(stack.data()), reinterpret_cast<const char*>(&stack + 1));
+
+    stack.push(4);
+    EXPECT_EQ(custom_memory_resource.statistics().allocations, 1);
+    EXPECT_EQ(stack.capacity(), 8);
+    std::vector<int> expected{0, 1, 2, 3, 4};
+    EXPECT_TRUE(std::equal(stack.begin(), stack.end(), expected.begin(), expected.end()));
+
+    stack.pop_n(2);
+    stack.shrink_to_fit();
+    EXPECT_EQ(stack.capacity(), 4);
+    EXPECT_EQ(custom_memory_resource.statistics().bytes_in_use, 0);
+    EXPECT_EQ(stack.top(), 2);
+
+    CustomStack<int, std::pmr::polymorphic_allocator<int>, 4> copy(stack, polymorphic_allocator);
+    copy.push_range(expected.begin(), expected.end());
+    stack = copy;
+    EXPECT_EQ(stack.size(), 8);
+    EXPECT_EQ(stack.top(), 4);
+    EXPECT_EQ(custom_memory_resource.statistics().allocations, 3);
+}
+
+TEST(StackTest, InlineCapacityMove) {
+    CustomMemoryResource custom_memory_resource(AllocationMode::first_fit, std::pmr::new_delete_resource());
+    using StringStack = CustomStack<std::pmr::string, std::pmr::polymorphic_allocator<std::pmr::string>, 2>;
+    StringStack stack(&custom_memory_resource);
+    stack.emplace("first");
+    StringStack moved(std::move(stack));
+    EXPECT_TRUE(stack.empty());
+    EXPECT_EQ(moved.top(), "first");
+    EXPECT_EQ(custom_memory_resource.statistics().allocations, 0);
+
+    moved.emplace("second");
+    moved.emplace("third");
+    const std::pmr::string* storage = moved.data();
+    stack = std::move(moved);
+    EXPECT_EQ(stack.data(), storage);
+    EXPECT_EQ(stack.size(), 3);
+    EXPECT_TRUE(moved.empty());
+    EXPECT_EQ(moved.capacity(), 2);
+    moved.emplace("reused");
+    EXPECT_EQ(moved.top(), "reused");
+
+    StringStack other(std::move(moved));
+    stack = std::move(other);
+    EXPECT_EQ(stack.size(), 1);
+    EXPECT_EQ(stack.top(), "reused");
+}
+
+TEST(SegmentedStackTest, StableReferences) {
+    CustomMemoryResource custom_memory_resource(AllocationMode::first_fit, std::pmr::new_delete_resource());
+    SegmentedCustomStack<int, std::pmr::polymorphic_allocator<int>, 16> stack(&custom_memory_resource);
+    EXPECT_THROW(stack.pop(), std::out_of_range);
+    EXPECT_THROW(stack.top(), std::out_of_range);
+    int& bottom = stack.emplace(-1);
+    std::vector<int*> addresses;
+    for (int i{0}; i < 1000; ++i) {
+        addresses.push_back(&stack.emplace(i));
+    }
+    EXPECT_EQ(bottom, -1);
+    EXPECT_EQ(stack.size(), 1001);
+    EXPECT_EQ(stack.chunk_count(), (1001 + 15) / 16);
+    for (int i{999}; i >= 0; --i) {
+        EXPECT_EQ(&stack.top(), addresses[i]);
+        EXPECT_EQ(stack.top(), i);
+        stack.pop();
+    }
+    EXPECT_EQ(&stack.top(), &bottom);
+
+    std::vector<int> visited;
+    SegmentedCustomStack<int, std::pmr::polymorphic_allocator<int>, 16> copy(stack, &custom_memory_resource);
+    copy.push(7);
+    copy.for_each([&visited](int item) { visited.push_back(item); });
+    EXPECT_EQ(visited, (std::vector<int>{-1, 7}));
+}
+
+TEST(SegmentedStackTest, SpareChunkAndFixedArena) {
+    CustomMemoryResource custom_memory_resource;
+    SegmentedCustomStack<int, std::pmr::polymorphic_allocator<int>, 32> stack(&custom_memory_resource);
+    for (int i{0}; i < 32; ++i) {
+        stack.push(i);
+    }
+    EXPECT_EQ(custom_memory_resource.statistics().allocations, 1);
+    for (int round{0}; round < 100; ++round) {
+        stack.push(round);
+        stack.pop();
+    }
+    EXPECT_EQ(custom_memory_resource.statistics().allocations, 2);
+    EXPECT_EQ(custom_memory_resource.statistics().deallocations, 0);
+
+    for (int i{32}; i < 192; ++i) {
+        stack.push(i);
+    }
+    EXPECT_EQ(stack.size(), 192);
+    EXPECT_EQ(stack.top(), 191);
+    stack.clear();
+    stack.shrink_to_fit();
+    EXPECT_EQ(custom_memory_resource.statistics().bytes_in_use, 0);
+}
+
+TEST(MappedAllocatorTest, ReopenKeepsBlocks) {
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "mapped_allocator_test.bin";
+    std::filesystem::remove(path);
+    std::uint64_t kept_offset{0};
+    {
+        MappedMemoryResource memory_resource(path.string(), 1 << 16, 16);
+        EXPECT_EQ(memory_resource.file_size(), 1 << 16);
+        void* first = memory_resource.allocate(100);
+        void* second = memory_resource.allocate(200, 64);
+        EXPECT_EQ(reinterpret_cast<std::uintptr_t>(second) % 64, 0);
+        EXPECT_TRUE(memory_resource.try_expand(second, 200, 4000));
+        EXPECT_FALSE(memory_resource.try_expand(first, 100, 1000));
+        EXPECT_THROW(static_cast<void>(memory_resource.allocate(1 << 16)), std::bad_alloc);
+        EXPECT_THROW(static_cast<void>(memory_resource.allocate(std::numeric_limits<std::size_t>::max() - 100, 8)), std::bad_alloc);
+        EXPECT_THROW(memory_resource.deallocate(static_cast<char*>(first) + 1, 100), std::logic_error);
+        memory_resource.deallocate(first, 100);
+        kept_offset = memory_resource.offset_of(second);
+        memory_resource.flush();
+    }
+    {
+        MappedMemoryResource memory_resource(path.string(), 1024);
+        EXPECT_EQ(memory_resource.file_size(), 1 << 16);
+        EXPECT_EQ(memory_resource.block_count(), 1);
+        EXPECT_THROW(memory_resource.deallocate(memory_resource.address_of(kept_offset), 200), std::logic_error);
+        memory_resource.deallocate(memory_resource.address_of(kept_offset), 4000);
+        EXPECT_EQ(memory_resource.block_count(), 0);
+    }
+    std::filesystem::remove(path);
+
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << std::string(4096, 'x');
+    }
+    EXPECT_THROW(MappedMemoryResource(path.string()), std::runtime_error);
+    std::filesystem::remove(path);
+}
+
+TEST(MappedAllocatorTest, ReattachStack) {
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "mapped_stack_test.bin";
+    std::filesystem::remove(path);
+    struct Sample {
+        int id;
+        double value;
+    };
+    {
+        MappedMemoryResource memory_resource(path.string());
+        CustomStack<Sample, std::pmr::polymorphic_allocator<Sample>> stack = load_stack<Sample>(memory_resource);
+        EXPECT_TRUE(stack.empty());
+        for (int i{0}; i < 1000; ++i) {
+            stack.push(Sample{i, i * 0.5});
+        }
+        save_stack(memory_resource, stack);
+        EXPECT_TRUE(stack.empty());
+    }
+    {
+        MappedMemoryResource memory_resource(path.string());
+        EXPECT_THROW(load_stack<int>(memory_resource), std::logic_error);
+        CustomStack<Sample, std::pmr::polymorphic_allocator<Sample>> stack = load_stack<Sample>(memory_resource);
+        ASSERT_EQ(stack.size(), 1000);
+        EXPECT_EQ(stack.top().id, 999);
+        EXPECT_EQ(stack.data()[10].value, 5.0);
+        EXPECT_EQ(memory_resource.root().size, 1000);
+        EXPECT_TRUE(load_stack<Sample>(memory_resource).empty());
+        std::uint64_t saved_offset = memory_resource.root().offset;
+        stack.pop_n(500);
+        stack.shrink_to_fit();
+        EXPECT_EQ(memory_resource.root().offset, saved_offset);
+        EXPECT_EQ(memory_resource.block_count(), 2);
+        CustomStack<Sample, std::pmr::polymorphic_allocator<Sample>, 4> small(&memory_resource);
+        small.push(Sample{-1, -1.0});
+        save_stack(memory_resource, small);
+        EXPECT_EQ(memory_resource.root().size, 1);
+        CustomStack<Sample, std::pmr::polymorphic_allocator<Sample>> other;
+        EXPECT_THROW(save_stack(memory_resource, other), std::logic_error);
+    }
+    {
+        MappedMemoryResource memory_resource(path.string());
+        EXPECT_EQ(memory_resource.block_count(), 1);
+        CustomStack<Sample, std::pmr::polymorphic_allocator<Sample>> stack = load_stack<Sample>(memory_resource);
+        EXPECT_EQ(stack.top().id, -1);
+        stack.push(Sample{-2, -2.0});
+        EXPECT_EQ(memory_resource.root().capacity, stack.capacity());
+        // The process dies before the next save: the storage is neither saved nor freed
+        static_cast<void>(stack.release());
+    }
+    {
+        MappedMemoryResource memory_resource(path.string());
+        EXPECT_EQ(memory_resource.block_count(), 1);
+        CustomStack<Sample, std::pmr::polymorphic_allocator<Sample>> stack = load_stack<Sample>(memory_resource);
+        ASSERT_EQ(stack.size(), 1);
+        EXPECT_EQ(stack.top().id, -1);
+        save_stack(memory_resource, stack);
+        EXPECT_EQ(memory_resource.block_count(), 1);
+        EXPECT_EQ(memory_resource.root().size, 1);
+    }
+    for (int run{0}; run < 2; ++run) {
+        // A clean exit without save_stack keeps the saved array as well
+        MappedMemoryResource memory_resource(path.string());
+        EXPECT_EQ(memory_resource.block_count(), 1);
+        CustomStack<Sample, std::pmr::polymorphic_allocator<Sample>> stack = load_stack<Sample>(memory_resource);
+        ASSERT_EQ(stack.size(), 1);
+        EXPECT_EQ(stack.top().id, -1);
+    }
+    std::filesystem::remove(path);
+}
+
+TEST(AllocatorTest, BitmapMode) {
+    CustomMemoryResource custom_memory_resource(AllocationMode::bitmap, nullptr, 16);
+    EXPECT_EQ(custom_memory_resource.slot_size(), 16);
+    std::vector<void*> blocks;
+    for (int i{0}; i < 64; ++i) {
+        blocks.push_back(custom_memory_resource.allocate(16, 16));
+        EXPECT_EQ(blocks.back(), static_cast<void*>(static_cast<char*>(blocks.front()) + 16 * i));
+    }
+    EXPECT_THROW(static_cast<void>(custom_memory_resource.allocate(1)), std::bad_alloc);
+    EXPECT_EQ(custom_memory_resource.statistics().free_bytes, 0);
+
+    custom_memory_resource.deallocate(blocks[10], 16, 16);
+    custom_memory_resource.deallocate(blocks[11], 16, 16);
+    custom_memory_resource.deallocate(blocks[40], 16, 16);
+    EXPECT_THROW(custom_memory_resource.deallocate(blocks[40], 16, 16), std::logic_error);
+    EXPECT_THROW(custom_memory_resource.deallocate(static_cast<char*>(blocks[5]) + 8, 16, 16), std::logic_error);
+    MemoryResourceStatistics statistics = custom_memory_resource.statistics();
+    EXPECT_EQ(statistics.free_bytes, 48);
+    EXPECT_EQ(statistics.largest_free_gap, 32);
+
+    void* pair = custom_memory_resource.allocate(20);
+    EXPECT_EQ(pair, blocks[10]);
+    EXPECT_EQ(custom_memory_resource.allocate(4), blocks[40]);
+    EXPECT_THROW(static_cast<void>(custom_memory_resource.allocate(4)), std::bad_alloc);
+    EXPECT_FALSE(custom_memory_resource.try_expand(pair, 20, 48));
+    EXPECT_TRUE(custom_memory_resource.try_expand(pair, 20, 32));
+    EXPECT_FALSE(custom_memory_resource.try_expand(pair, 32, std::numeric_limits<std::size_t>::max()));
+
+    std::size_t max_size = std::numeric_limits<std::size_t>::max();
+    EXPECT_THROW(static_cast<void>(custom_memory_resource.allocate(max_size - 5, 8)), std::bad_alloc);
+    CustomMemoryResource growing_memory_resource(AllocationMode::bitmap, std::pmr::new_delete_resource(), 16);
+    EXPECT_THROW(static_cast<void>(growing_memory_resource.allocate(max_size - 5, 8)), std::bad_alloc);
+    EXPECT_THROW(static_cast<void>(growing_memory_resource.allocate(max_size)), std::bad_alloc);
+    ConcurrentCustomMemoryResource<> concurrent_memory_resource(AllocationMode::bitmap, std::pmr::new_delete_resource());
+    EXPECT_THROW(static_cast<void>(concurrent_memory_resource.allocate(max_size - 5, 8)), std::bad_alloc);
+}
+
+TEST(AllocatorTest, BitmapModeGrowsAndRuns) {
+    CustomMemoryResource custom_memory_resource(AllocationMode::bitmap, std::pmr::new_delete_resource(), 8);
+    std::vector<void*> blocks;
+    for (int i{0}; i < 1000; ++i) {
+        blocks.push_back(custom_memory_resource.allocate(8, 8));
+    }
+    EXPECT_GT(custom_memory_resource.chunk_count(), 1);
+    for (std::size_t i{0}; i < blocks.size(); i += 2) {
+        custom_memory_resource.deallocate(blocks[i], 8, 8);
+    }
+    void* run = custom_memory_resource.allocate(24, 8);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(run) % 8, 0);
+    for (std::size_t i{1}; i < blocks.size(); i += 2) {
+        EXPECT_FALSE(run <= blocks[i] && blocks[i] < static_cast<void*>(static_cast<char*>(run) + 24));
+    }
+    custom_memory_resource.deallocate(run, 24, 8);
+
+    std::pmr::list<int> nodes(&custom_memory_resource);
+    for (int i{0}; i < 500; ++i) {
+        nodes.push_back(i);
+    }
+    EXPECT_EQ(std::accumulate(nodes.begin(), nodes.end(), 0), 499 * 500 / 2);
+    CustomStack<int, std::pmr::polymorphic_allocator<int>> stack(&custom_memory_resource);
+    for (int i{0}; i < 300; ++i) {
+        stack.push(i);
+    }
+    EXPECT_EQ(stack.top(), 299);
+}
+
+TEST(StackTest, GrowthPolicies) {
+    CustomMemoryResource custom_memory_resource(AllocationMode::first_fit, std::pmr::new_delete_resource());
+    using Allocator = std::pmr::polymorphic_allocator<int>;
+    auto capacities = [&custom_memory_resource]<typename Stack>(Stack stack) {
+        std::vector<std::size_t> result{stack.capacity()};
+        for (int i{0}; i < 40; ++i) {
+            stack.push(i);
+            if (stack.capacity() != result.back()) {
+                result.push_back(stack.capacity());
+            }
+        }
+        return result;
+    };
+    EXPECT_EQ(capacities(CustomStack<int, Allocator>(1, &custom_memory_resource)),
+              (std::vector<std::size_t>{1, 2, 4, 8, 16, 32, 64}));
+    EXPECT_EQ(capacities(CustomStack<int, Allocator, 0, GeometricGrowth<3, 2>>(1, &custom_memory_resource)),
+              (std::vector<std::size_t>{1, 2, 3, 4, 6, 9, 13, 19, 28, 42}));
+    EXPECT_EQ(capacities(CustomStack<int, Allocator, 0, FixedIncrementGrowth<16>>(1, &custom_memory_resource)),
+              (std::vector<std::size_t>{1, 17, 33, 49}));
+    EXPECT_EQ(capacities(CustomStack<int, Allocator, 0, CacheLineGrowth>(1, &custom_memory_resource)),
+              (std::vector<std::size_t>{1, 16, 32, 64}));
+    EXPECT_EQ(capacities(CustomStack<int, Allocator, 0, PageGrowth>(1, &custom_memory_resource)),
+              (std::vector<std::size_t>{1, 1024}));
+}
+
+TEST(StackTest, HysteresisShrink) {
+    CustomMemoryResource custom_memory_resource(AllocationMode::first_fit, std::pmr::new_delete_resource());
+    CustomStack<int, std::pmr::polymorphic_allocator<int>, 0, HysteresisShrink<>> stack(&custom_memory_resource);
+    for (int i{0}; i < 1000; ++i) {
+        stack.push(i);
+    }
+    EXPECT_EQ(stack.capacity(), 1024);
+    while (stack.size() > 255) {
+        stack.pop();
+    }
+    EXPECT_EQ(stack.capacity(), 512);
+    std::size_t allocations = custom_memory_resource.statistics().allocations;
+    for (int round{0}; round < 100; ++round) {
+        stack.push(round);
+        stack.pop();
+    }
+    EXPECT_EQ(custom_memory_resource.statistics().allocations, allocations);
+    stack.pop_n(250);
+    EXPECT_EQ(stack.capacity(), 16);
+    EXPECT_EQ(stack.top(), 4);
+    stack.pop_n(5);
+    EXPECT_EQ(stack.capacity(), 1);
+    EXPECT_EQ(custom_memory_resource.statistics().bytes_in_use, sizeof(int));
+
+    CustomStack<int, std::pmr::polymorphic_allocator<int>, 8, HysteresisShrink<>> small(&custom_memory_resource);
+    for (int i{0}; i < 64; ++i) {
+        small.push(i);
+    }
+    small.pop_n(62);
+    EXPECT_EQ(small.capacity(), 8);
+    EXPECT_EQ(small.top(), 1);
+
+    small.push(2);
+    small.push(3);
+    small.unchecked_pop();
+    EXPECT_EQ(small.capacity(), 8);
+
+    TlsfMemoryResource tlsf_memory_resource(131072);
+    CustomStack<int, std::pmr::polymorphic_allocator<int>, 0, HysteresisShrink<>> tlsf_stack(&tlsf_memory_resource);
+    tlsf_stack.reserve(12000);
+    for (int i{0}; i < 12000; ++i) {
+        tlsf_stack.push(i);
+    }
+    tlsf_stack.pop_n(11999);
+    EXPECT_EQ(tlsf_stack.capacity(), 2);
+    std::vector<void*> blocks;
+    try {
+        while (true) {
+            blocks.push_back(tlsf_memory_resource.allocate(4096));
+        }
+    } catch (const std::bad_alloc&) {
+    }
+    EXPECT_GT(blocks.size() * 4096, 100000);
+    for (void* block : blocks) {
+        tlsf_memory_resource.deallocate(block, 4096);
+    }
+}
+
+TEST(StackTest, StaticCustomAllocator) {
+    CustomMemoryResource custom_memory_resource;
+    CustomAllocator<int> allocator(&custom_memory_resource);
+    CustomStack<int, CustomAllocator<int>> stack(1, allocator);
+    const int* first = &stack.emplace(0);
+    for (int i{1}; i < 100; ++i) {
+        stack.push(i);
+    }
+    EXPECT_EQ(&*stack.begin(), first);
+    EXPECT_EQ(stack.top(), 99);
+    EXPECT_EQ(stack.get_allocator(), allocator);
+    EXPECT_THROW(allocator.allocate(std::numeric_limits<std::size_t>::max()), std::bad_array_new_length);
+
+    CustomAllocator<long> rebound(allocator);
+    long* value = rebound.allocate(1);
+    *value = 42;
+    EXPECT_TRUE(custom_memory_resource.statistics().bytes_in_use > 0);
+    rebound.deallocate(value, 1);
+    EXPECT_EQ(rebound.resource(), &custom_memory_resource);
+
+    CustomStack<int, std::allocator<int>> standard_stack;
+    for (int i{0}; i < 10; ++i) {
+        standard_stack.push(i);
+    }
+    CustomStack<int, std::allocator<int>> standard_copy(standard_stack);
+    EXPECT_EQ(standard_copy.size(), 10);
+    EXPECT_EQ(standard_copy.top(), 9);
+}
+
+TEST(StackTest, AllocatorPropagation) {
+    CustomMemoryResource first_resource;
+    CustomMemoryResource second_resource;
+    using Stack = CustomStack<int, CustomAllocator<int>>;
+    Stack first(4, CustomAllocator<int>(&first_resource));
+    Stack second(4, CustomAllocator<int>(&second_resource));
+    first.push(1);
+    second.push(2);
+    second.push(3);
+
+    const int* second_data = &*second.begin();
+    first.swap(second);
+    EXPECT_EQ(first.get_allocator().resource(), &second_resource);
+    EXPECT_EQ(second.get_allocator().resource(), &first_resource);
+    EXPECT_EQ(&*first.begin(), second_data);
+    EXPECT_EQ(first.size(), 2);
+    EXPECT_EQ(second.top(), 1);
+
+    second = first;
+    EXPECT_EQ(second.get_allocator().resource(), &first_resource);
+    EXPECT_EQ(second.top(), 3);
+
+    second = std::move(first);
+    EXPECT_EQ(second.get_allocator().resource(), &second_resource);
+    EXPECT_EQ(&*second.begin(), second_data);
+    EXPECT_EQ(first_resource.statistics().bytes_in_use, 0);
+
+    using PolymorphicStack = CustomStack<int, std::pmr::polymorphic_allocator<int>>;
+    PolymorphicStack left(&first_resource);
+    PolymorphicStack right(&second_resource);
+    left.push(1);
+    right.push(2);
+    right.push(3);
+    swap(left, right);
+    EXPECT_EQ(left.get_allocator().resource(), &first_resource);
+    EXPECT_EQ(right.get_allocator().resource(), &second_resource);
+    EXPECT_EQ(left.size(), 2);
+    EXPECT_EQ(left.top(), 3);
+    EXPECT_EQ(right.top(), 1);
+}
+
+TEST(StackTest, NonThrowingFastPath) {
+    CustomMemoryResource custom_memory_resource(AllocationMode::first_fit, std::pmr::null_memory_resource());
+    CustomStack<int, std::pmr::polymorphic_allocator<int>, 4> stack(&custom_memory_resource);
+    static_assert(noexcept(stack.try_pop()));
+    static_assert(noexcept(stack.unchecked_top()));
+    static_assert(noexcept(stack.unchecked_pop()));
+
+    EXPECT_FALSE(stack.try_pop().has_value());
+    int pushed{0};
+    while (stack.try_push(pushed)) {
+        ++pushed;
+    }
+    EXPECT_GT(pushed, 4);
+    EXPECT_EQ(stack.size(), static_cast<std::size_t>(pushed));
+    EXPECT_EQ(stack.unchecked_top(), pushed - 1);
+    EXPECT_EQ(stack.try_emplace(0), nullptr);
+    EXPECT_THROW(stack.push(0), std::bad_alloc);
+
+    std::optional<int> top = stack.try_pop();
+    ASSERT_TRUE(top.has_value());
+    EXPECT_EQ(*top, pushed - 1);
+    stack.unchecked_pop();
+    EXPECT_EQ(stack.size(), static_cast<std::size_t>(pushed - 2));
+    EXPECT_EQ(*stack.try_emplace(100), 100);
+    static_assert(!noexcept(stack.try_push(0)));
+    CustomStack<int, std::allocator<int>> std_stack;
+    static_assert(noexcept(std_stack.try_push(0)));
+    static_assert(noexcept(std_stack.try_emplace(0)));
+
+    // A bad_alloc thrown by the element itself is not an allocation failure
+    struct FailingItem {
+        explicit FailingItem(bool fail) {
+            if (fail) {
+                throw std::bad_alloc();
+            }
+        }
+    };
+    CustomStack<FailingItem, std::pmr::polymorphic_allocator<FailingItem>> failing(1, std::pmr::new_delete_resource());
+    ASSERT_NE(failing.try_emplace(false), nullptr);
+    EXPECT_THROW(failing.try_emplace(true), std::bad_alloc);
+    EXPECT_EQ(failing.size(), 1);
+
+    CustomStack<std::string, std::pmr::polymorphic_allocator<std::string>> strings(std::pmr::new_delete_resource());
+    strings.push("first");
+    strings.push("second");
+    std::optional<std::string> moved = strings.try_pop();
+    EXPECT_EQ(moved, "second");
+    EXPECT_EQ(strings.unchecked_top(), "first");
+}
+
+TEST(AllocatorTest, CompactionRelocatesStacks) {
+    using Stack = CustomStack<int, std::pmr::polymorphic_allocator<int>>;
+    BasicCustomMemoryResource<4096> memory_resource;
+    void* gap = memory_resource.allocate(256);
+    CustomStack<std::string, std::pmr::polymorphic_allocator<std::string>> pinned(4, &memory_resource);
+    pinned.push("pinned");
+    const std::string* pinned_data = &pinned.top();
+    std::vector<std::unique_ptr<Stack>> stacks;
+    for (int stack_index{0}; stack_index < 4; ++stack_index) {
+        stacks.push_back(std::make_unique<Stack>(200, &memory_resource));
+        stacks.back()->enable_relocation();
+        for (int i{0}; i < 200; ++i) {
+            stacks.back()->push(stack_index * 1000 + i);
+        }
+    }
+    memory_resource.deallocate(gap, 256);
+    stacks[0].reset();
+    stacks[2].reset();
+    EXPECT_THROW(static_cast<void>(memory_resource.allocate(2000)), std::bad_alloc);
+    EXPECT_GT(memory_resource.statistics().external_fragmentation, 0.0);
+
+    Stack moved(std::move(*stacks[3]));
+    EXPECT_EQ(memory_resource.compact(), 2);
+    EXPECT_EQ(&pinned.top(), pinned_data);
+    EXPECT_EQ(pinned.top(), "pinned");
+    EXPECT_EQ(stacks[1]->size(), 200);
+    EXPECT_EQ(stacks[1]->top(), 1199);
+    EXPECT_EQ(*stacks[1]->begin(), 1000);
+    EXPECT_EQ(*moved.begin(), 3000);
+    EXPECT_EQ(moved.top(), 3199);
+    EXPECT_EQ(memory_resource.compact(), 0);
+
+    void* large = memory_resource.allocate(2000);
+    memory_resource.deallocate(large, 2000);
+    stacks[1]->push(42);
+    moved.pop();
+    EXPECT_EQ(stacks[1]->top(), 42);
+    EXPECT_EQ(moved.top(), 3198);
+
+    Stack::Storage storage = moved.release();
+    EXPECT_EQ(memory_resource.compact(), 0);
+    Stack reattached(storage, &memory_resource);
+    reattached.enable_relocation();
+    EXPECT_EQ(reattached.top(), 3198);
+}
+
+TEST(AllocatorTest, CompactionWithStaticAllocator) {
+    CustomMemoryResource memory_resource;
+    CustomAllocator<std::int64_t> allocator(&memory_resource);
+    std::int64_t* gap = allocator.allocate(16);
+    CustomStack<std::int64_t, CustomAllocator<std::int64_t>> stack(16, allocator);
+    for (std::int64_t i{0}; i < 16; ++i) {
+        stack.push(i);
+    }
+    const std::int64_t* before = stack.data();
+    allocator.deallocate(gap, 16);
+    EXPECT_EQ(memory_resource.compact(), 0);
+    EXPECT_EQ(stack.data(), before);
+    stack.enable_relocation();
+    EXPECT_EQ(memory_resource.compact(), 1);
+    EXPECT_LT(stack.data(), before);
+    EXPECT_EQ(stack.top(), 15);
+    EXPECT_EQ(std::accumulate(stack.begin(), stack.end(), std::int64_t{0}), 120);
+
+    CustomMemoryResource bitmap_resource(AllocationMode::bitmap);
+    void* block = bitmap_resource.allocate(64);
+    EXPECT_FALSE(bitmap_resource.set_relocation_handler(block, nullptr));
+    EXPECT_EQ(bitmap_resource.compact(), 0);
+    bitmap_resource.deallocate(block, 64);
+}
+
+TEST(RecordingTest, TraceRoundTrip) {
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "recording_test.trace";
+    {
+        CustomMemoryResource custom_memory_resource(AllocationMode::first_fit, std::pmr::new_delete_resource());
+        RecordingMemoryResource recording(path.string(), &custom_memory_resource, 8);
+        {
+            CustomStack<int, std::pmr::polymorphic_allocator<int>> stack(1, &recording);
+            for (int i{0}; i < 100; ++i) {
+                stack.push(i);
+            }
+        }
+        void* first = recording.allocate(24, 8);
+        void* second = recording.allocate(48, 16);
+        recording.deallocate(first, 24, 8);
+        EXPECT_THROW(recording.deallocate(first, 24, 8), std::logic_error);
+        recording.flush();
+        EXPECT_EQ(recording.recorded_events(), TraceReader(path.string()).read_all().size());
+        recording.deallocate(second, 48, 16);
+    }
+
+    std::vector<TraceRecord> records = TraceReader(path.string()).read_all();
+    ASSERT_GE(records.size(), 6);
+    EXPECT_EQ(records.front().event, TraceEvent::allocate);
+    EXPECT_EQ(records.front().size, sizeof(int));
+    std::size_t expansions{0};
+    for (std::size_t index = 1; index < records.size(); ++index) {
+        EXPECT_GE(records[index].timestamp, records[index - 1].timestamp);
+        expansions += records[index].event == TraceEvent::expand;
+    }
+    EXPECT_GT(expansions, 0);
+    const TraceRecord& last = records.back();
+    EXPECT_EQ(last.event, TraceEvent::deallocate);
+    EXPECT_EQ(last.size, 48);
+    EXPECT_EQ(last.alignment, 16);
+    EXPECT_EQ(records[records.size() - 2].event, TraceEvent::deallocate);
+    EXPECT_EQ(records[records.size() - 2].id + 1, last.id);
+    EXPECT_EQ(records[records.size() - 4].id, records[records.size() - 2].id);
+    std::filesystem::remove(path);
+
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << "not a trace";
+    }
+    EXPECT_THROW(TraceReader(path.string()), std::runtime_error);
+    std::filesystem::remove(path);
+}